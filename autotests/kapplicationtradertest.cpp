@@ -45,7 +45,15 @@ private Q_SLOTS:
     void initTestCase();
     void testTraderConstraints_data();
     void testTraderConstraints();
+    void testQueryWithConstraints();
+    void testQueryByCategories();
     void testQueryByMimeType();
+    void testQueryBySchemeHandler();
+    void testQueryCache();
+    void testPreferredService();
+    void testSearch();
+    void testMatchSubsequence();
+    void testParallelFilter();
     void testThreads();
     void testTraderQueryMustRebuildSycoca();
     void testSetPreferredService();
@@ -275,6 +283,72 @@ void KApplicationTraderTest::testTraderConstraints()
     checkResult(offers, expectedResult);
 }
 
+void KApplicationTraderTest::testQueryWithConstraints()
+{
+    using Constraint = KApplicationTrader::Constraint;
+    FF isFakeApplication = [](const KService::Ptr &serv) {
+        return serv->name() == QLatin1String("FakeApplication");
+    };
+
+    KService::List offers = KApplicationTrader::query({Constraint::hasCategory(QStringLiteral("FakeCategory"))});
+    checkResult(offers, ExpectedResult::FakeApplicationAndOthers);
+    for (const KService::Ptr &service : std::as_const(offers)) {
+        QVERIFY(service->categories().contains(QLatin1String("FakeCategory")));
+    }
+
+    offers = KApplicationTrader::query({Constraint::hasCategory(QStringLiteral("FakeCategory")), Constraint::terminal(false)}, isFakeApplication);
+    checkResult(offers, ExpectedResult::FakeApplicationOnly);
+
+    offers = KApplicationTrader::query({Constraint::hasCategory(QStringLiteral("FakeCategory")), Constraint::terminal(true)}, isFakeApplication);
+    checkResult(offers, ExpectedResult::NoResults);
+
+    offers = KApplicationTrader::query({Constraint::noDisplay(false), Constraint::propertyEquals(QStringLiteral("X-KDE-Version"), QStringLiteral("5.56"))},
+                                       isFakeApplication);
+    checkResult(offers, ExpectedResult::FakeApplicationOnly);
+
+    offers = KApplicationTrader::query({Constraint::propertyEquals(QStringLiteral("X-KDE-Version"), QStringLiteral("4.0"))}, isFakeApplication);
+    checkResult(offers, ExpectedResult::NoResults);
+
+    offers = KApplicationTrader::query({Constraint::hasProperty(QStringLiteral("X-KDE-Version"))}, isFakeApplication);
+    checkResult(offers, ExpectedResult::FakeApplicationOnly);
+
+    offers = KApplicationTrader::query({Constraint::hasCategory(QStringLiteral("NoSuchCategory"))});
+    checkResult(offers, ExpectedResult::NoResults);
+
+    // Same result as the equivalent filter function
+    const KService::List expected = KApplicationTrader::query([](const KService::Ptr &serv) {
+        return serv->categories().contains(QLatin1String("FakeCategory"));
+    });
+    offers = KApplicationTrader::query({Constraint::hasCategory(QStringLiteral("FakeCategory"))});
+    QCOMPARE(offers.count(), expected.count());
+    for (int i = 0; i < offers.count(); ++i) {
+        QCOMPARE(offers.at(i)->entryPath(), expected.at(i)->entryPath());
+    }
+}
+
+void KApplicationTraderTest::testQueryByCategories()
+{
+    const QStringList categories = KApplicationTrader::allCategories();
+    QVERIFY(categories.contains(QLatin1String("FakeCategory")));
+    QVERIFY(std::is_sorted(categories.cbegin(), categories.cend()));
+
+    const QStringList fakeAndMissing{QStringLiteral("FakeCategory"), QStringLiteral("NoSuchCategory")};
+    KService::List offers = KApplicationTrader::queryByCategories({QStringLiteral("FakeCategory")});
+    QVERIFY(offerListHasService(offers, m_fakeApplication));
+    QVERIFY(offerListHasService(offers, m_fakeSchemeHandler));
+    QVERIFY(!offerListHasService(offers, m_fakeGnomeApplication)); // OnlyShowIn=Gnome
+
+    offers = KApplicationTrader::queryByCategories(fakeAndMissing, KApplicationTrader::MatchAnyCategory);
+    QVERIFY(offerListHasService(offers, m_fakeApplication));
+    offers = KApplicationTrader::queryByCategories(fakeAndMissing, KApplicationTrader::MatchAllCategories);
+    checkResult(offers, ExpectedResult::NoResults);
+
+    offers = KApplicationTrader::queryByCategories({QStringLiteral("FakeCategory")}, KApplicationTrader::MatchAllCategories, [](const KService::Ptr &serv) {
+        return serv->name() == QLatin1String("FakeApplication");
+    });
+    checkResult(offers, ExpectedResult::FakeApplicationOnly);
+}
+
 void KApplicationTraderTest::testQueryByMimeType()
 {
     KService::List offers;
@@ -309,6 +383,157 @@ void KApplicationTraderTest::testQueryByMimeType()
     checkResult(offers, ExpectedResult::NoResults);
 }
 
+void KApplicationTraderTest::testQueryBySchemeHandler()
+{
+    KService::List offers = KApplicationTrader::queryBySchemeHandler(QStringLiteral("someprotocol"));
+    checkResult(offers, ExpectedResult::FakeSchemeHandlerOnly);
+
+    offers = KApplicationTrader::queryBySchemeHandler(QStringLiteral("nosuchprotocol"));
+    checkResult(offers, ExpectedResult::NoResults);
+
+    const KService::Ptr handler = KApplicationTrader::preferredSchemeHandler(QStringLiteral("someprotocol"));
+    QVERIFY(handler);
+    QCOMPARE(handler->entryPath(), m_fakeSchemeHandler);
+    QCOMPARE(handler->schemeHandlers(), QStringList{QStringLiteral("someprotocol")});
+    QVERIFY(!KApplicationTrader::preferredSchemeHandler(QStringLiteral("nosuchprotocol")));
+}
+
+void KApplicationTraderTest::testQueryCache()
+{
+    const KService::List offers = KApplicationTrader::queryByMimeType(QStringLiteral("text/plain"));
+    const KApplicationTrader::QueryCacheStatistics before = KApplicationTrader::queryCacheStatistics();
+
+    // Same MIME type again: answered from the cache, with the same result
+    QCOMPARE(KApplicationTrader::queryByMimeType(QStringLiteral("text/plain")), offers);
+    KApplicationTrader::QueryCacheStatistics after = KApplicationTrader::queryCacheStatistics();
+    QCOMPARE(after.hits, before.hits + 1);
+    QCOMPARE(after.misses, before.misses);
+
+    // A filter doesn't change the cached list
+    const KService::List filtered = KApplicationTrader::queryByMimeType(QStringLiteral("text/plain"), [](const KService::Ptr &) {
+        return false;
+    });
+    QVERIFY(filtered.isEmpty());
+    QCOMPARE(KApplicationTrader::queryByMimeType(QStringLiteral("text/plain")), offers);
+
+    // Disabled cache
+    KApplicationTrader::setQueryCacheCapacity(0);
+    const KApplicationTrader::QueryCacheStatistics disabled = KApplicationTrader::queryCacheStatistics();
+    const KService::List uncached = KApplicationTrader::queryByMimeType(QStringLiteral("text/plain"));
+    QCOMPARE(uncached.count(), offers.count());
+    QCOMPARE(uncached.at(0)->entryPath(), offers.at(0)->entryPath());
+    after = KApplicationTrader::queryCacheStatistics();
+    QCOMPARE(after.hits, disabled.hits);
+    QCOMPARE(after.misses, disabled.misses + 1);
+    KApplicationTrader::setQueryCacheCapacity(64);
+}
+
+void KApplicationTraderTest::testPreferredService()
+{
+    // The precomputed preferred service is the first offer
+    const QStringList mimeTypes{QStringLiteral("text/plain"), QStringLiteral("text/html"), QStringLiteral("image/png"), QStringLiteral("x-scheme-handler/someprotocol")};
+    for (const QString &mimeType : mimeTypes) {
+        const KService::List offers = KApplicationTrader::queryByMimeType(mimeType);
+        const KService::Ptr preferred = KApplicationTrader::preferredService(mimeType);
+        QCOMPARE(bool(preferred), !offers.isEmpty());
+        if (preferred) {
+            QCOMPARE(preferred->entryPath(), offers.first()->entryPath());
+        }
+    }
+
+    // MIME type names are case insensitive
+    const KService::Ptr plainText = KApplicationTrader::preferredService(QStringLiteral("text/plain"));
+    QVERIFY(plainText);
+    QCOMPARE(KApplicationTrader::preferredService(QStringLiteral("TEXT/PLAIN"))->entryPath(), plainText->entryPath());
+
+    QTest::ignoreMessage(QtWarningMsg, "KApplicationTrader: mimeType \"no/such/mimetype\" not found");
+    QVERIFY(!KApplicationTrader::preferredService(QStringLiteral("no/such/mimetype")));
+}
+
+void KApplicationTraderTest::testSearch()
+{
+    KService::List results = KApplicationTrader::search(QStringLiteral("fakeapplication"));
+    checkResult(results, ExpectedResult::FakeApplicationOnly);
+
+    // case and diacritics are ignored, words match anywhere inside words
+    results = KApplicationTrader::search(QStringLiteral("FÀKEAppl"));
+    checkResult(results, ExpectedResult::FakeApplicationOnly);
+    results = KApplicationTrader::search(QStringLiteral("application"));
+    checkResult(results, ExpectedResult::FakeApplicationOnly);
+
+    // short words only match the start of words
+    results = KApplicationTrader::search(QStringLiteral("fa"));
+    QVERIFY(offerListHasService(results, m_fakeApplication));
+    QVERIFY(offerListHasService(results, m_fakeSchemeHandler));
+    QVERIFY(!offerListHasService(results, m_fakeGnomeApplication));
+    results = KApplicationTrader::search(QStringLiteral("ap"));
+    QVERIFY(!offerListHasService(results, m_fakeApplication));
+
+    // all the words must match
+    results = KApplicationTrader::search(QStringLiteral("fake scheme"));
+    checkResult(results, ExpectedResult::FakeSchemeHandlerOnly);
+    results = KApplicationTrader::search(QStringLiteral("fake nosuchword"));
+    checkResult(results, ExpectedResult::NoResults);
+
+    QCOMPARE(KApplicationTrader::search(QStringLiteral("fake"), 1).count(), 1);
+    checkResult(KApplicationTrader::search(QString()), ExpectedResult::NoResults);
+}
+
+void KApplicationTraderTest::testMatchSubsequence()
+{
+    QList<KApplicationTrader::SubsequenceMatch> matches = KApplicationTrader::matchSubsequence(QStringLiteral("fkapp"));
+    auto it = std::find_if(matches.cbegin(), matches.cend(), [this](const KApplicationTrader::SubsequenceMatch &match) {
+        return match.service->entryPath() == m_fakeApplication;
+    });
+    QVERIFY(it != matches.cend());
+    QCOMPARE(it->service->name(), QStringLiteral("FakeApplication"));
+    QCOMPARE(it->positions, (QList<int>{0, 2, 4, 5, 6}));
+    QVERIFY(it->score > 0);
+
+    // a prefix match scores higher than a scattered one
+    const KService::List services{KService::serviceByDesktopPath(m_fakeApplication)};
+    QVERIFY(services.first());
+    const int prefixScore = KApplicationTrader::matchSubsequence(QStringLiteral("fake"), services).value(0).score;
+    const int scatteredScore = KApplicationTrader::matchSubsequence(QStringLiteral("fapn"), services).value(0).score;
+    QVERIFY(prefixScore > scatteredScore);
+    QVERIFY(scatteredScore > 0);
+
+    QVERIFY(KApplicationTrader::matchSubsequence(QStringLiteral("fakez"), services).isEmpty());
+    QVERIFY(KApplicationTrader::matchSubsequence(QString()).isEmpty());
+    QCOMPARE(KApplicationTrader::matchSubsequence(QStringLiteral("fake"), 1).count(), 1);
+}
+
+// Each query decodes new services, compare what they are
+static QStringList storageIds(const KService::List &services)
+{
+    QStringList ids;
+    for (const KService::Ptr &service : services) {
+        ids.append(service->storageId());
+    }
+    return ids;
+}
+
+// An expensive filter, like the ones looking for the executable of each service
+static bool hasExecutable(const KService::Ptr &service)
+{
+    const QString exec = service->exec().section(QLatin1Char(' '), 0, 0);
+    return !exec.isEmpty() && !QStandardPaths::findExecutable(exec).isEmpty();
+}
+
+void KApplicationTraderTest::testParallelFilter()
+{
+    const KService::List serial = KApplicationTrader::query(hasExecutable);
+    const KService::List parallel = KApplicationTrader::query(hasExecutable, KApplicationTrader::ParallelFilter);
+    QVERIFY(offerListHasService(parallel, m_fakeApplication)); // Exec=ls
+    QCOMPARE(storageIds(parallel), storageIds(serial)); // same services, same order
+
+    auto filter = [](const KService::Ptr &service) {
+        return service->name() != QLatin1String("FakeApplication");
+    };
+    QCOMPARE(storageIds(KApplicationTrader::queryByMimeType(QStringLiteral("text/plain"), filter, KApplicationTrader::ParallelFilter)),
+             storageIds(KApplicationTrader::queryByMimeType(QStringLiteral("text/plain"), filter)));
+}
+
 QString KApplicationTraderTest::createFakeApplication(const QString &filename, const QString &name, const QMap<QString, QString> &extraFields)
 {
     const QString fakeService = QStandardPaths::writableLocation(QStandardPaths::ApplicationsLocation) + QLatin1Char('/') + filename;
@@ -20,6 +20,7 @@
 #include <QTest>
 #include <kapplicationtrader.h>
 #include <kbuildsycoca_p.h>
+#include <kmimetypefactory_p.h>
 #include <kservicefactory_p.h>
 #include <ksycoca.h>
 
@@ -360,6 +361,46 @@ private Q_SLOTS:
         QCOMPARE(assembleOffers(offers), QStringList() << QStringLiteral("fakejpegapplication.desktop"));
     }
 
+    void testParseSyntax()
+    {
+        KOfferHash offerHash;
+        KMimeAssociations parser(offerHash, KSycocaPrivate::self()->serviceFactory());
+
+        QTemporaryDir tempDir;
+        QVERIFY(tempDir.isValid());
+        QFile tempFile(tempDir.path() + QLatin1String{"/mimeapps.list"});
+        QVERIFY(tempFile.open(QIODevice::WriteOnly));
+        tempFile.write(
+            "# a comment\r\n"
+            "[Other Group]\r\n"
+            "image/png=fakejpegapplication.desktop;\r\n"
+            "\r\n"
+            "[Default Applications]\r\n"
+            "  image/jpeg = fakehtmlapplication.desktop;\r\n"
+            "text/html=fakejpegapplication.desktop;\r\n"
+            "text/html=fakehtmlapplication.desktop;fakejpegapplication.desktop\r\n" // the last one wins
+            "[Removed Associations]\n"
+            "image/jpeg=fakehtmlapplication.desktop;fakejpegapplication.desktop;\n"
+            "[Added Associations]\n"
+            "text/plain=fake\\x68tmlapplication.desktop\\x3bfakejpegapplication.desktop;\\xZZ;\n");
+        const QString fileName = tempFile.fileName();
+        tempFile.close();
+
+        parser.parseMimeAppsList(fileName, 100);
+
+        QVERIFY(offerHash.offersFor(QStringLiteral("image/png")).isEmpty());
+        // Default Applications come after the removed associations
+        QCOMPARE(assembleOffers(offerHash.offersFor(QStringLiteral("image/jpeg"))), QStringList{QStringLiteral("fakehtmlapplication.desktop")});
+        QVERIFY(offerHash.hasRemovedOffer(QStringLiteral("image/jpeg"), KService::serviceByStorageId(QStringLiteral("fakejpegapplication.desktop"))));
+        const QList<KServiceOffer> htmlOffers = offerHash.offersFor(QStringLiteral("text/html"));
+        QCOMPARE(assembleOffers(htmlOffers), (QStringList{QStringLiteral("fakehtmlapplication.desktop"), QStringLiteral("fakejpegapplication.desktop")}));
+        QCOMPARE(htmlOffers.at(0).preference(), 125);
+        QCOMPARE(htmlOffers.at(1).preference(), 124);
+        // Escaped bytes, like KConfig reads them
+        QCOMPARE(assembleOffers(offerHash.offersFor(QStringLiteral("text/plain"))),
+                 (QStringList{QStringLiteral("fakehtmlapplication.desktop"), QStringLiteral("fakejpegapplication.desktop")}));
+    }
+
     void testSetupRealFile()
     {
         writeToMimeApps(m_mimeAppsFileContents);
@@ -407,6 +448,30 @@ private Q_SLOTS:
         QVERIFY(offerListHasService(offers, fakeTextApplication, true));
     }
 
+    void testMimeTypeNames()
+    {
+        KSycoca::self()->ensureCacheValid();
+        KMimeTypeFactory *factory = KSycocaPrivate::self()->mimeTypeFactory();
+        QMimeDatabase db;
+
+        // same results as QMimeDatabase, for names and aliases
+        QCOMPARE(factory->canonicalName(QStringLiteral("text/plain")), QStringLiteral("text/plain"));
+        QCOMPARE(factory->canonicalName(QStringLiteral("application/x-pdf")), db.mimeTypeForName(QStringLiteral("application/x-pdf")).name());
+        QCOMPARE(factory->canonicalName(QStringLiteral("application/x-pdf")), QStringLiteral("application/pdf"));
+        QCOMPARE(factory->canonicalName(QStringLiteral("no/such/mimetype")), QString());
+
+        const QMimeType shellScript = db.mimeTypeForName(QStringLiteral("application/x-shellscript"));
+        QCOMPARE(factory->parents(shellScript.name()), shellScript.parentMimeTypes());
+        QCOMPARE(factory->allAncestors(shellScript.name()), shellScript.allAncestors());
+
+        // aliases are resolved when querying offers
+        const KService::List offers = KApplicationTrader::queryByMimeType(QStringLiteral("application/x-pdf"));
+        QVERIFY(offerListHasService(offers, fakeJpegApplication, true));
+        const KService::Ptr msWordApplication = KService::serviceByStorageId(QStringLiteral("fakecsrcmswordapplication.desktop"));
+        QVERIFY(msWordApplication);
+        QVERIFY(msWordApplication->hasMimeType(QStringLiteral("application/x-msword")));
+    }
+
     void testRemoveAssociationFromParent()
     {
         // I removed kate from text/plain, and it would still appear in text/x-java.
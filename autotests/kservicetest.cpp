@@ -283,6 +283,10 @@ void KServiceTest::testByStorageId()
     QVERIFY(!KService::serviceByMenuId(QStringLiteral("faketestapp.desktop"))); // doesn't work, full filename mandatory
     QVERIFY(KService::serviceByStorageId(QStringLiteral("org.kde.faketestapp.desktop")));
     QVERIFY(KService::serviceByStorageId(QStringLiteral("org.kde.faketestapp")));
+    QVERIFY(KService::serviceByStorageId(QStringLiteral("/no/such/dir/org.kde.faketestapp.desktop"))); // falls back to the desktop name
+    const QString testAppPath = KService::serviceByStorageId(QStringLiteral("org.kde.faketestapp"))->entryPath();
+    QCOMPARE(KService::serviceByStorageId(testAppPath)->entryPath(), testAppPath);
+    QVERIFY(!KService::serviceByStorageId(QStringLiteral("org.kde.nosuchapp.desktop")));
 
     QVERIFY(KService::serviceByDesktopName(QStringLiteral("org.kde.faketestapp")));
     QCOMPARE(KService::serviceByDesktopName(QStringLiteral("org.kde.faketestapp"))->menuId(), QStringLiteral("org.kde.faketestapp.desktop"));
@@ -452,6 +456,9 @@ void KServiceTest::testMimeType()
     KService::Ptr testapp = KService::serviceByDesktopName(QStringLiteral("org.kde.otherfakeapp"));
     QVERIFY(testapp);
     QCOMPARE(testapp->mimeTypes(), {QStringLiteral("application/pdf")});
+    QVERIFY(testapp->hasMimeType(QStringLiteral("application/pdf")));
+    QVERIFY(!testapp->hasMimeType(QStringLiteral("image/png")));
+    QVERIFY(!testapp->hasMimeType(QStringLiteral("no/such/mimetype")));
 }
 
 void KServiceTest::testProtocols()
@@ -5,18 +5,30 @@
     SPDX-License-Identifier: LGPL-2.0-or-later
 */
 
+#include <KConfig>
 #include <KConfigGroup>
 #include <KDesktopFile>
+#include <QBuffer>
 #include <QDebug>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
 #include <QProcess>
+#include <QRegularExpression>
+#include <QScopeGuard>
 #include <QSignalSpy>
 #include <QTemporaryDir>
 #include <QTest>
+#include <kapplicationtrader.h>
 #include <kbuildsycoca_p.h>
+#include <kctimefactory_p.h>
 #include <kservice.h>
 #include <kservicefactory_p.h>
+#include <kservicegroup.h>
 #include <ksycoca.h>
 #include <ksycoca_p.h>
+#include <ksycocabuildprofile_p.h>
+#include <ksycocadirectoryscanner_p.h>
 
 #ifdef Q_OS_UNIX
 #include <sys/time.h>
@@ -73,6 +85,15 @@ private Q_SLOTS:
     void testDeletingSycoca();
     void testNonReadableSycoca();
     void extraFileInFutureShouldRebuildSycocaOnce();
+    void eachDirectoryShouldBeReadOnce();
+    void resourceHashShouldNotDependOnStatCache();
+    void smallChangeShouldBeAppended();
+    void daemonShouldUpdateDatabase();
+    void keptBuildStateShouldBeReused();
+    void fingerprintsShouldDetectContentChanges();
+    void profileShouldReportPhasesAndCounts();
+    void storedCTimeDictShouldBeSearchable();
+    void associationChangeShouldOnlyUpdateOffers();
 
 private:
     void createTestApp()
@@ -321,4 +342,434 @@ void KSycocaTest::extraFileInFutureShouldRebuildSycocaOnce()
     QVERIFY(QFile::remove(path));
 }
 
+void KSycocaTest::eachDirectoryShouldBeReadOnce()
+{
+#ifndef Q_OS_LINUX
+    QSKIP("This test relies on strace");
+#else
+    const QString strace = QStandardPaths::findExecutable(QStringLiteral("strace"));
+    if (strace.isEmpty()) {
+        QSKIP("strace not found");
+    }
+    {
+        QProcess probe;
+        probe.start(strace, {QStringLiteral("-o"), QStringLiteral("/dev/null"), QStringLiteral("true")});
+        if (!probe.waitForFinished() || probe.exitStatus() != QProcess::NormalExit || probe.exitCode() != 0) {
+            QSKIP("strace can't trace processes here (ptrace not permitted?)");
+        }
+    }
+    QDir(appsDir()).mkpath(QStringLiteral("subdir"));
+
+    const QString logFile = m_tempDir.path() + QLatin1String("/kbuildsycoca.strace");
+    QProcess proc;
+    proc.setProcessChannelMode(QProcess::ForwardedChannels);
+    proc.start(strace,
+               {QStringLiteral("-f"),
+                QStringLiteral("-e"),
+                QStringLiteral("trace=open,openat"),
+                QStringLiteral("-o"),
+                logFile,
+                QStringLiteral(KBUILDSYCOCAEXE),
+                QStringLiteral("--testmode"),
+                QStringLiteral("--noincremental")});
+    QVERIFY(proc.waitForFinished());
+    QCOMPARE(proc.exitStatus(), QProcess::NormalExit);
+    QCOMPARE(proc.exitCode(), 0);
+    QFile log(logFile);
+    QVERIFY(log.open(QIODevice::ReadOnly));
+
+    // Every applications directory should be listed exactly once per build
+    static const QRegularExpression openRe(QStringLiteral("open(?:at)?\\((?:AT_FDCWD, )?\"([^\"]+)\"[^)]*O_DIRECTORY"));
+    QHash<QString, int> opened;
+    while (!log.atEnd()) {
+        const QString line = QString::fromLocal8Bit(log.readLine());
+        const QRegularExpressionMatch match = openRe.match(line);
+        if (match.hasMatch()) {
+            const QString dir = QDir::cleanPath(match.captured(1));
+            if (dir.contains(QLatin1String("/applications"))) {
+                ++opened[dir];
+            }
+        }
+    }
+    QVERIFY(opened.contains(QDir::cleanPath(appsDir())));
+    for (auto it = opened.cbegin(); it != opened.cend(); ++it) {
+        QVERIFY2(it.value() == 1, qPrintable(QStringLiteral("%1 was opened %2 times").arg(it.key()).arg(it.value())));
+    }
+    QVERIFY(QDir(appsDir() + QLatin1String("subdir")).removeRecursively());
+#endif
+}
+
+void KSycocaTest::resourceHashShouldNotDependOnStatCache()
+{
+    const QString subdir = QStringLiteral("applications");
+    const QString relPath = QStringLiteral("org.kde.test.desktop");
+    const QString absPath = appsDir() + relPath;
+    const quint32 hash = KBuildSycoca::calcResourceHash(subdir, relPath);
+    QVERIFY(hash != 0);
+
+    KSycocaDirectoryScanner scanner;
+    QCOMPARE(KBuildSycoca::calcResourceHash(subdir, relPath, &scanner), hash);
+    QCOMPARE(scanner.locateAll(subdir + QLatin1Char('/') + relPath),
+             QStandardPaths::locateAll(QStandardPaths::GenericDataLocation, subdir + QLatin1Char('/') + relPath));
+
+    // Same result when the information comes from the directory listing
+    KSycocaDirectoryScanner listingScanner;
+    QVERIFY(listingScanner.relativeFilePaths(appsDir()).contains(relPath));
+    QCOMPARE(KBuildSycoca::calcResourceHash(subdir, relPath, &listingScanner), hash);
+    QCOMPARE(KBuildSycoca::calcResourceHash(subdir, absPath, &listingScanner), KBuildSycoca::calcResourceHash(subdir, absPath));
+
+    QCOMPARE(KBuildSycoca::calcResourceHash(subdir, QStringLiteral("doesnotexist.desktop"), &scanner), 0u);
+}
+
+void KSycocaTest::smallChangeShouldBeAppended()
+{
+    ksycoca_ms_between_checks = 0;
+    {
+        KBuildSycoca builder;
+        QVERIFY(builder.recreate(false));
+    }
+    QFile database(KSycoca::absoluteFilePath());
+    QVERIFY(database.open(QIODevice::ReadOnly));
+    const QByteArray fullDatabase = database.readAll();
+    database.close();
+    const qint64 fullSize = fullDatabase.size();
+    KService::Ptr service = KService::serviceByDesktopName(QStringLiteral("org.kde.test"));
+    QVERIFY(service);
+    const int offset = service->offset();
+
+    QTest::qWait(s_waitDelay);
+    const QString newAppPath = appsDir() + QLatin1String("org.kde.test.appended.desktop");
+    {
+        KDesktopFile app(newAppPath);
+        app.desktopGroup().writeEntry("Type", "Application");
+        app.desktopGroup().writeEntry("Exec", "appendedApp");
+        app.desktopGroup().writeEntry("Name", "Appended App");
+    }
+    {
+        KBuildSycoca builder;
+        QVERIFY(builder.recreate());
+    }
+
+    // The new service was appended in place, the unchanged one stayed where it was
+    QVERIFY(database.open(QIODevice::ReadOnly));
+    const qint64 appendedSize = database.size();
+    QVERIFY(appendedSize > fullSize);
+    QCOMPARE(database.read(fullSize), fullDatabase);
+    database.close();
+    QVERIFY(KService::serviceByDesktopName(QStringLiteral("org.kde.test.appended")));
+    service = KService::serviceByDesktopName(QStringLiteral("org.kde.test"));
+    QVERIFY(service);
+    QCOMPARE(service->offset(), offset);
+    QCOMPARE(service->name(), QStringLiteral("Test App"));
+
+    // A full build compacts it again
+    QVERIFY(QFile::remove(newAppPath));
+    {
+        KBuildSycoca builder;
+        QVERIFY(builder.recreate(false));
+    }
+    QVERIFY(!KService::serviceByDesktopName(QStringLiteral("org.kde.test.appended")));
+    QVERIFY(QFileInfo(KSycoca::absoluteFilePath()).size() < appendedSize);
+}
+
+void KSycocaTest::daemonShouldUpdateDatabase()
+{
+    const QString databasePath = KSycoca::absoluteFilePath();
+    const QDateTime startTimestamp = QFileInfo(databasePath).lastModified();
+    QTest::qWait(s_waitDelay);
+
+    const QString newAppPath = appsDir() + QLatin1String("org.kde.test.daemon.desktop");
+    QProcess daemon;
+    daemon.setProcessChannelMode(QProcess::ForwardedChannels);
+    daemon.start(QStringLiteral(KBUILDSYCOCAEXE), {QStringLiteral("--testmode"), QStringLiteral("--daemon")});
+    QVERIFY(daemon.waitForStarted());
+    // Also when a check fails
+    auto cleanup = qScopeGuard([&]() {
+        daemon.terminate();
+        daemon.waitForFinished();
+        QFile::remove(newAppPath);
+    });
+    QTRY_VERIFY_WITH_TIMEOUT(QFileInfo(databasePath).lastModified() > startTimestamp, 10000); // initial build
+    const QDateTime oldTimestamp = QFileInfo(databasePath).lastModified();
+    QTest::qWait(s_waitDelay);
+    {
+        KDesktopFile app(newAppPath);
+        app.desktopGroup().writeEntry("Type", "Application");
+        app.desktopGroup().writeEntry("Exec", "daemonApp");
+        app.desktopGroup().writeEntry("Name", "Daemon App");
+    }
+    QTRY_VERIFY_WITH_TIMEOUT(QFileInfo(databasePath).lastModified() > oldTimestamp, 10000);
+    QCOMPARE(daemon.state(), QProcess::Running);
+
+    // Found without any rebuild from this process
+    ksycoca_ms_between_checks = 0;
+    QVERIFY(!KSycoca::self()->needsRebuild());
+    QVERIFY(KService::serviceByDesktopName(QStringLiteral("org.kde.test.daemon")));
+
+    // Removed again by the next update, which starts from the entries kept in memory
+    const QDateTime addedTimestamp = QFileInfo(databasePath).lastModified();
+    QTest::qWait(s_waitDelay);
+    QVERIFY(QFile::remove(newAppPath));
+    QTRY_VERIFY_WITH_TIMEOUT(QFileInfo(databasePath).lastModified() > addedTimestamp, 10000);
+    QVERIFY(!KSycoca::self()->needsRebuild());
+    QVERIFY(!KService::serviceByDesktopName(QStringLiteral("org.kde.test.daemon")));
+    QVERIFY(KService::serviceByDesktopName(QStringLiteral("org.kde.test")));
+}
+
+void KSycocaTest::keptBuildStateShouldBeReused()
+{
+    ksycoca_ms_between_checks = 0;
+    KBuildSycoca builder;
+    builder.setKeepBuildState(true);
+    QVERIFY(builder.recreate(false));
+    KService::Ptr service = KService::serviceByDesktopName(QStringLiteral("org.kde.test"));
+    QVERIFY(service);
+    const int offset = service->offset();
+
+    QTest::qWait(s_waitDelay);
+    const QString newAppPath = appsDir() + QLatin1String("org.kde.test.kept.desktop");
+    {
+        KDesktopFile app(newAppPath);
+        app.desktopGroup().writeEntry("Type", "Application");
+        app.desktopGroup().writeEntry("Exec", "keptApp");
+        app.desktopGroup().writeEntry("Name", "Kept App");
+    }
+    auto cleanup = qScopeGuard([&]() {
+        QFile::remove(newAppPath);
+    });
+    QVERIFY(builder.recreate());
+    QVERIFY(KService::serviceByDesktopName(QStringLiteral("org.kde.test.kept")));
+    service = KService::serviceByDesktopName(QStringLiteral("org.kde.test"));
+    QVERIFY(service);
+    QCOMPARE(service->offset(), offset);
+    QCOMPARE(service->name(), QStringLiteral("Test App"));
+
+    QTest::qWait(s_waitDelay);
+    QVERIFY(QFile::remove(newAppPath));
+    QVERIFY(builder.recreate());
+    QVERIFY(!KService::serviceByDesktopName(QStringLiteral("org.kde.test.kept")));
+    service = KService::serviceByDesktopName(QStringLiteral("org.kde.test"));
+    QVERIFY(service);
+    QCOMPARE(service->name(), QStringLiteral("Test App"));
+}
+
+void KSycocaTest::fingerprintsShouldDetectContentChanges()
+{
+    qputenv("KSYCOCA_FINGERPRINTS", "1");
+    ksycoca_ms_between_checks = 0;
+    {
+        KBuildSycoca builder;
+        QVERIFY(builder.recreate(false));
+    }
+    KSycoca::self()->ensureCacheValid();
+    QVERIFY(KSycocaPrivate::self()->readSycocaHeader().sourcesFingerprint != 0);
+    QVERIFY(KSycocaPrivate::self()->fingerprintsMatch());
+
+    // Change the contents, but not the modification time
+    const QString appPath = appsDir() + QLatin1String("org.kde.test.desktop");
+    const QDateTime modificationTime = QFileInfo(appPath).lastModified();
+    {
+        KDesktopFile app(appPath);
+        app.desktopGroup().writeEntry("Name", "Changed Test App");
+    }
+    {
+        QFile file(appPath);
+        QVERIFY(file.open(QIODevice::ReadWrite));
+        QVERIFY(file.setFileTime(modificationTime, QFileDevice::FileModificationTime));
+    }
+    QVERIFY(!KSycocaPrivate::self()->fingerprintsMatch());
+
+    // An incremental build notices it
+    {
+        KBuildSycoca builder;
+        QVERIFY(builder.recreate());
+    }
+    KService::Ptr service = KService::serviceByDesktopName(QStringLiteral("org.kde.test"));
+    QVERIFY(service);
+    QCOMPARE(service->name(), QStringLiteral("Changed Test App"));
+
+    qunsetenv("KSYCOCA_FINGERPRINTS");
+    createTestApp();
+    {
+        KBuildSycoca builder;
+        QVERIFY(builder.recreate(false));
+    }
+    KSycoca::self()->ensureCacheValid();
+    QVERIFY(!KSycocaPrivate::self()->readSycocaHeader().sourcesFingerprint);
+}
+
+void KSycocaTest::profileShouldReportPhasesAndCounts()
+{
+    KSycocaBuildProfile profile;
+    KSycocaBuildProfile::setCurrent(&profile);
+    {
+        KBuildSycoca builder;
+        QVERIFY(builder.recreate(false));
+    }
+    KSycocaBuildProfile::setCurrent(nullptr);
+
+    QJsonParseError error;
+    const QJsonObject report = QJsonDocument::fromJson(profile.toJson(), &error).object();
+    QCOMPARE(error.error, QJsonParseError::NoError);
+    QCOMPARE(report.value(QLatin1String("databaseVersion")).toInt(), KSycoca::version());
+    QVERIFY(report.value(QLatin1String("wallMs")).toDouble() > 0);
+
+    QStringList phaseNames;
+    const QJsonArray phases = report.value(QLatin1String("phases")).toArray();
+    for (const QJsonValue &phase : phases) {
+        phaseNames.append(phase.toObject().value(QLatin1String("name")).toString());
+        QVERIFY(phase.toObject().value(QLatin1String("calls")).toInt() > 0);
+    }
+    for (const char *name : {"build", "scan", "parallel-parse", "menu", "save", "post-process", "mimeapps", "dict-save", "commit"}) {
+        QVERIFY2(phaseNames.contains(QLatin1String(name)), name);
+    }
+
+    const QJsonObject counts = report.value(QLatin1String("counts")).toObject();
+    QVERIFY(counts.value(QLatin1String("directoriesRead")).toInt() > 0);
+    QVERIFY(counts.value(QLatin1String("entriesParsed")).toInt() > 0);
+    QVERIFY(counts.value(QLatin1String("dictEntries")).toInt() > 0);
+    QCOMPARE(counts.value(QLatin1String("bytesWritten")).toInteger(), QFileInfo(KSycoca::absoluteFilePath()).size());
+}
+
+void KSycocaTest::storedCTimeDictShouldBeSearchable()
+{
+    KCTimeDict dict;
+    const QStringList paths{QStringLiteral("org.kde.b.desktop"), QStringLiteral("org.kde.a.desktop"), QStringLiteral("kde/é.desktop")};
+    for (int i = 0; i < paths.count(); ++i) {
+        dict.addCTime(paths.at(i), "apps", 100 + i);
+    }
+    dict.addCTime(QStringLiteral("text/plain.xml"), "xdgdata-mime", 42);
+    dict.addCTime(QStringLiteral("org.kde.a.desktop"), "xdgdata-dirs", 43);
+
+    QByteArray data;
+    {
+        QDataStream out(&data, QIODevice::WriteOnly);
+        out.setVersion(QDataStream::Qt_5_3);
+        dict.save(out);
+    }
+    QBuffer buffer(&data);
+    QVERIFY(buffer.open(QIODevice::ReadOnly));
+    QDataStream in(&buffer);
+    in.setVersion(QDataStream::Qt_5_3);
+    KCTimeDict stored;
+    stored.load(&in);
+    QCOMPARE(in.status(), QDataStream::Ok);
+    QVERIFY(buffer.atEnd());
+    buffer.close(); // the dict has its own copy
+
+    for (int i = 0; i < paths.count(); ++i) {
+        QCOMPARE(stored.ctime(paths.at(i), "apps"), quint64(100 + i));
+    }
+    QCOMPARE(stored.ctime(QStringLiteral("text/plain.xml"), "xdgdata-mime"), quint64(42));
+    QCOMPARE(stored.ctime(QStringLiteral("org.kde.a.desktop"), "xdgdata-dirs"), quint64(43));
+    QCOMPARE(stored.ctime(QStringLiteral("org.kde.c.desktop"), "apps"), quint64(0));
+    QCOMPARE(stored.ctime(QStringLiteral("text/plain.xml"), "apps"), quint64(0));
+    QCOMPARE(stored.ctime(QStringLiteral("org.kde.a.desktop"), "unknown"), quint64(0));
+
+    QCOMPARE(stored.take(QStringLiteral("org.kde.a.desktop"), "apps"), quint64(101));
+    QCOMPARE(stored.take(QStringLiteral("org.kde.a.desktop"), "apps"), quint64(0));
+    QCOMPARE(stored.ctime(QStringLiteral("org.kde.a.desktop"), "apps"), quint64(0));
+    QCOMPARE(stored.ctime(QStringLiteral("org.kde.a.desktop"), "xdgdata-dirs"), quint64(43));
+    QVERIFY(!stored.isEmpty());
+    stored.remove(paths.at(0), "apps");
+    stored.remove(paths.at(2), "apps");
+    stored.remove(QStringLiteral("text/plain.xml"), "xdgdata-mime");
+    stored.remove(QStringLiteral("org.kde.a.desktop"), "xdgdata-dirs");
+    QVERIFY(stored.isEmpty());
+}
+
+void KSycocaTest::associationChangeShouldOnlyUpdateOffers()
+{
+    ksycoca_ms_between_checks = 0;
+    const QString mimeAppsPath = QStandardPaths::writableLocation(QStandardPaths::GenericConfigLocation) + QLatin1String("/mimeapps.list");
+    {
+        KConfig mimeApps(mimeAppsPath, KConfig::SimpleConfig);
+        mimeApps.group(QStringLiteral("Added Associations")).writeEntry("x-test/x-association", QString());
+    }
+    {
+        KBuildSycoca builder;
+        QVERIFY(builder.recreate(false));
+    }
+    QVERIFY(!KApplicationTrader::preferredService(QStringLiteral("text/plain")));
+    const int menuCount = KServiceGroup::root()->entries().count();
+
+    QTest::qWait(s_waitDelay);
+    {
+        KConfig mimeApps(mimeAppsPath, KConfig::SimpleConfig);
+        mimeApps.group(QStringLiteral("Added Associations")).writeXdgListEntry("text/plain", {QStringLiteral("org.kde.test.desktop")});
+    }
+    QVERIFY(KSycoca::self()->needsRebuild());
+
+    KSycocaBuildProfile profile;
+    KSycocaBuildProfile::setCurrent(&profile);
+    {
+        KBuildSycoca builder;
+        QVERIFY(builder.recreate());
+    }
+    KSycocaBuildProfile::setCurrent(nullptr);
+
+    // No file parsed, no menu built
+    const QJsonObject report = QJsonDocument::fromJson(profile.toJson()).object();
+    const QJsonArray phases = report.value(QLatin1String("phases")).toArray();
+    for (const QJsonValue &phase : phases) {
+        const QString name = phase.toObject().value(QLatin1String("name")).toString();
+        QVERIFY2(name != QLatin1String("scan") && name != QLatin1String("menu"), qPrintable(name));
+    }
+    QCOMPARE(report.value(QLatin1String("counts")).toObject().value(QLatin1String("entriesParsed")).toInt(), 0);
+
+    const KService::Ptr preferred = KApplicationTrader::preferredService(QStringLiteral("text/plain"));
+    QVERIFY(preferred);
+    QVERIFY(!KSycoca::self()->needsRebuild());
+    QCOMPARE(preferred->desktopEntryName(), QStringLiteral("org.kde.test"));
+    QVERIFY(preferred->hasMimeType(QStringLiteral("text/plain")));
+    QCOMPARE(KServiceGroup::root()->entries().count(), menuCount);
+
+    // Nothing changed since: the database isn't written again
+    QFile database(KSycoca::absoluteFilePath());
+    QVERIFY(database.open(QIODevice::ReadOnly));
+    const QByteArray databaseContents = database.readAll();
+    database.close();
+    {
+        KBuildSycoca builder;
+        QVERIFY(builder.recreate());
+    }
+    QVERIFY(database.open(QIODevice::ReadOnly));
+    QCOMPARE(database.readAll(), databaseContents);
+    database.close();
+
+    // Editing a file in place doesn't change the modification time of its directory,
+    // the services are built again nonetheless
+    QTest::qWait(s_waitDelay);
+    QFile app(appsDir() + QLatin1String("org.kde.test.desktop"));
+    QVERIFY(app.open(QIODevice::ReadOnly));
+    QByteArray appContents = app.readAll();
+    app.close();
+    appContents.replace("Name=Test App", "Name=Edited Test App");
+    QVERIFY(app.open(QIODevice::WriteOnly));
+    QCOMPARE(app.write(appContents), appContents.size());
+    app.close();
+    {
+        KConfig mimeApps(mimeAppsPath, KConfig::SimpleConfig);
+        mimeApps.group(QStringLiteral("Added Associations")).writeXdgListEntry("text/html", {QStringLiteral("org.kde.test.desktop")});
+    }
+    {
+        KBuildSycoca builder;
+        QVERIFY(builder.recreate());
+    }
+    KService::Ptr service = KService::serviceByDesktopName(QStringLiteral("org.kde.test"));
+    QVERIFY(service);
+    QCOMPARE(service->name(), QStringLiteral("Edited Test App"));
+    const KService::Ptr htmlPreferred = KApplicationTrader::preferredService(QStringLiteral("text/html"));
+    QVERIFY(htmlPreferred);
+    QCOMPARE(htmlPreferred->desktopEntryName(), QStringLiteral("org.kde.test"));
+
+    createTestApp();
+    QVERIFY(QFile::remove(mimeAppsPath));
+    {
+        KBuildSycoca builder;
+        QVERIFY(builder.recreate(false));
+    }
+    QVERIFY(!KApplicationTrader::preferredService(QStringLiteral("text/plain")));
+}
+
 #include "ksycocatest.moc"
@@ -6,7 +6,9 @@
     SPDX-License-Identifier: LGPL-2.0-only
 */
 
+#include "kbuildsycocadaemon.h"
 #include <kbuildsycoca_p.h>
+#include <ksycocabuildprofile_p.h>
 
 #include <kservice_version.h>
 
@@ -105,6 +107,11 @@ int main(int argc, char **argv)
         QCommandLineOption(QStringLiteral("track"), i18nc("@info:shell command-line option", "Track menu id for debug purposes"), QStringLiteral("menu-id")));
     parser.addOption(
         QCommandLineOption(QStringLiteral("testmode"), i18nc("@info:shell command-line option", "Switch QStandardPaths to test mode, for unit tests only")));
+    parser.addOption(QCommandLineOption(QStringLiteral("daemon"),
+                                        i18nc("@info:shell command-line option", "Keep running, and update the database whenever the files it caches change")));
+    parser.addOption(QCommandLineOption(QStringLiteral("profile"),
+                                        i18nc("@info:shell command-line option", "Write a JSON profile of the build to file, - for stdout"),
+                                        QStringLiteral("file")));
     parser.process(app);
     about.processCommandLine(&parser);
 
@@ -120,6 +127,20 @@ int main(int argc, char **argv)
 
     const bool incremental = !parser.isSet(QStringLiteral("noincremental"));
 
+    if (parser.isSet(QStringLiteral("daemon"))) {
+        KBuildSycocaDaemon daemon(parser.value(QStringLiteral("track")));
+        if (!daemon.start(incremental)) {
+            return -1;
+        }
+        return app.exec();
+    }
+
+    KSycocaBuildProfile profile;
+    const QString profileFile = parser.value(QStringLiteral("profile"));
+    if (!profileFile.isEmpty()) {
+        KSycocaBuildProfile::setCurrent(&profile);
+    }
+
     KBuildSycoca sycoca; // Build data base
     if (parser.isSet(QStringLiteral("track"))) {
         sycoca.setTrackId(parser.value(QStringLiteral("track")));
@@ -129,5 +150,14 @@ int main(int argc, char **argv)
         return -1;
     }
 
+    if (!profileFile.isEmpty()) {
+        QFile out(profileFile);
+        const bool opened = profileFile == QLatin1String("-") ? out.open(stdout, QIODevice::WriteOnly) : out.open(QIODevice::WriteOnly);
+        if (!opened || out.write(profile.toJson()) == -1) {
+            fprintf(stderr, "%s: couldn't write the profile to %s\n", KBUILDSYCOCA_EXENAME, qPrintable(profileFile));
+            return -1;
+        }
+    }
+
     return 0;
 }
@@ -0,0 +1,94 @@
+/*
+    This file is part of the KDE libraries
+    SPDX-FileCopyrightText: 2026 agent <agent@local>
+
+    SPDX-License-Identifier: LGPL-2.0-or-later
+*/
+
+#include "kbuildsycocadaemon.h"
+#include "kbuildsycocadebug.h"
+
+#include <ksycoca_p.h>
+
+#include <QElapsedTimer>
+
+// Package managers install many files in a row, build once for all of them
+static const int s_rebuildDelay = 100; // ms
+
+KBuildSycocaDaemon::KBuildSycocaDaemon(const QString &trackId)
+    : m_daemonLock(KSycoca::absoluteFilePath() + QLatin1String(".daemon.lock"))
+{
+    m_sycoca.setKeepBuildState(true);
+    if (!trackId.isEmpty()) {
+        m_sycoca.setTrackId(trackId);
+    }
+
+    m_rebuildTimer.setSingleShot(true);
+    m_rebuildTimer.setInterval(s_rebuildDelay);
+    QObject::connect(&m_rebuildTimer, &QTimer::timeout, &m_rebuildTimer, [this]() {
+        rebuild(true);
+    });
+
+    auto scheduleRebuild = [this]() {
+        // Applications noticing the change wait for the rebuild rather than building the database themselves
+        if (!m_sycoca.lockDatabase()) {
+            qCDebug(SYCOCA) << "The database is being built by someone else";
+        }
+        m_rebuildTimer.start();
+    };
+    QObject::connect(&m_dirWatch, &KDirWatch::dirty, &m_rebuildTimer, scheduleRebuild);
+    QObject::connect(&m_dirWatch, &KDirWatch::created, &m_rebuildTimer, scheduleRebuild);
+    QObject::connect(&m_dirWatch, &KDirWatch::deleted, &m_rebuildTimer, scheduleRebuild);
+}
+
+bool KBuildSycocaDaemon::start(bool incremental)
+{
+    if (!m_daemonLock.tryLock()) {
+        qCWarning(SYCOCA) << "Another" << KBUILDSYCOCA_EXENAME << "daemon is already running";
+        return false;
+    }
+    return rebuild(incremental);
+}
+
+bool KBuildSycocaDaemon::rebuild(bool incremental)
+{
+    QElapsedTimer timer;
+    timer.start();
+
+    // Reuse the database written last time, not the one opened before it
+    KSycocaPrivate::self()->closeDatabase();
+
+    const bool result = m_sycoca.recreate(incremental);
+    if (result) {
+        qCDebug(SYCOCA) << "Database updated in" << timer.elapsed() << "ms";
+    } else {
+        qCWarning(SYCOCA) << "Couldn't update the database";
+    }
+
+    updateWatches();
+    return result;
+}
+
+void KBuildSycocaDaemon::updateWatches()
+{
+    KSycocaPrivate *d = KSycocaPrivate::self();
+    d->closeDatabase(); // the one written by the builder
+    (void)d->readSycocaHeader();
+
+    // The menu code can add directories
+    QStringList dirs = d->allResourceDirs.keys();
+    dirs += KBuildSycoca::factoryResourceDirs();
+    for (const QString &dir : std::as_const(dirs)) {
+        if (!m_dirWatch.contains(dir)) {
+            m_dirWatch.addDir(dir, KDirWatch::WatchSubDirs | KDirWatch::WatchFiles);
+        }
+    }
+    // Including the mimeapps.list files which don't exist yet, KDirWatch tells when they're created
+    QStringList files = d->extraFiles.keys();
+    files += KBuildSycoca::factoryExtraFileCandidates();
+    for (const QString &file : std::as_const(files)) {
+        if (!m_dirWatch.contains(file)) {
+            m_dirWatch.addFile(file);
+        }
+    }
+}
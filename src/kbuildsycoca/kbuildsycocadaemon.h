@@ -0,0 +1,55 @@
+/*
+    This file is part of the KDE libraries
+    SPDX-FileCopyrightText: 2026 agent <agent@local>
+
+    SPDX-License-Identifier: LGPL-2.0-or-later
+*/
+
+#ifndef KBUILDSYCOCADAEMON_H
+#define KBUILDSYCOCADAEMON_H
+
+#include <KDirWatch>
+
+#include <kbuildsycoca_p.h>
+
+#include <QLockFile>
+#include <QString>
+#include <QTimer>
+
+/**
+ * The --daemon mode of kbuildsycoca.
+ *
+ * Watches the directories and files which the database depends on (the ones stored in its header,
+ * which applications check when looking for changes) and updates the database shortly after any
+ * of them changes, incrementally. The builder is kept between updates, with the entries, the file
+ * timestamps and the parsed menu files of the previous build (see KBuildSycoca::setKeepBuildState()):
+ * an update only parses what changed, and only appends that to the database.
+ *
+ * Clients don't talk to the daemon: they keep checking the timestamps as usual. The daemon takes the
+ * lock of KBuildSycoca::recreate() as soon as it sees a change (see KBuildSycoca::lockDatabase()), so a
+ * client noticing it before the new database is written, even while the daemon waits for more changes,
+ * waits for the lock and then finds the database up to date. Unless a client was already building
+ * the database itself: the daemon then waits for it in turn.
+ */
+class KBuildSycocaDaemon
+{
+public:
+    explicit KBuildSycocaDaemon(const QString &trackId);
+
+    /**
+     * Build the database, and start watching for changes.
+     * @return false if another daemon is running, or if the database couldn't be written
+     */
+    bool start(bool incremental);
+
+private:
+    bool rebuild(bool incremental);
+    void updateWatches();
+
+    QLockFile m_daemonLock;
+    KDirWatch m_dirWatch;
+    QTimer m_rebuildTimer;
+    KBuildSycoca m_sycoca;
+};
+
+#endif
@@ -12,42 +12,175 @@
 #include "kservicefactory_p.h"
 #include "ksycoca.h"
 #include "ksycoca_p.h"
+#include "kserviceutil_p.h"
+#include "ksubsequencematcher_p.h"
 #include "servicesdebug.h"
 
-#include <QMimeDatabase>
+#include <QBitArray>
+#include <QHash>
+#include <QSemaphore>
+#include <QSet>
+#include <QThreadPool>
+
+#include <atomic>
+#include <memory>
+#include <vector>
 
 #include <KConfigGroup>
 #include <KSharedConfig>
 
-static KService::List mimeTypeSycocaServiceOffers(const QString &mimeType)
+// Returns the offer records for the URL scheme @p scheme, without decoding any service
+static QList<KServiceFactory::OfferRecord> schemeHandlerSycocaOfferRecords(const QString &scheme)
 {
-    KService::List lst;
-    QMimeDatabase db;
-    QString mime = db.mimeTypeForName(mimeType).name();
-    if (mime.isEmpty()) {
-        if (!mimeType.startsWith(QLatin1String("x-scheme-handler/"))) { // don't warn for unknown scheme handler mimetypes
-            qCWarning(SERVICES) << "KApplicationTrader: mimeType" << mimeType << "not found";
-            return lst; // empty
-        }
-        mime = mimeType;
+    KSycoca::self()->ensureCacheValid();
+    int serviceOffersOffset;
+    const int offset = KSycocaPrivate::self()->mimeTypeFactory()->schemeHandlerEntryOffset(scheme, serviceOffersOffset);
+    if (!offset || serviceOffersOffset < 0) {
+        return {}; // no handler for this scheme
+    }
+    return KSycocaPrivate::self()->serviceFactory()->offerRecords(offset, serviceOffersOffset);
+}
+
+// Returns the offer records for the given MIME type, without decoding any service
+static QList<KServiceFactory::OfferRecord> mimeTypeSycocaOfferRecords(const QString &mimeType)
+{
+    const QLatin1String schemeHandlerPrefix("x-scheme-handler/");
+    if (mimeType.startsWith(schemeHandlerPrefix)) {
+        // QMimeDatabase doesn't know about scheme handlers, use the dedicated index
+        return schemeHandlerSycocaOfferRecords(mimeType.mid(schemeHandlerPrefix.size()));
     }
+
     KSycoca::self()->ensureCacheValid();
     KMimeTypeFactory *factory = KSycocaPrivate::self()->mimeTypeFactory();
-    const int offset = factory->entryOffset(mime);
+    const QString mime = factory->canonicalName(mimeType); // resolves aliases
+    const int offset = mime.isEmpty() ? 0 : factory->entryOffset(mime);
     if (!offset) {
-        if (!mimeType.startsWith(QLatin1String("x-scheme-handler/"))) { // don't warn for unknown scheme handler mimetypes
-            qCWarning(SERVICES) << "KApplicationTrader: mimeType" << mimeType << "not found";
-        }
-        return lst; // empty
+        qCWarning(SERVICES) << "KApplicationTrader: mimeType" << mimeType << "not found";
+        return {}; // empty
     }
     const int serviceOffersOffset = factory->serviceOffersOffset(mime);
     if (serviceOffersOffset > -1) {
-        lst = KSycocaPrivate::self()->serviceFactory()->serviceOffers(offset, serviceOffersOffset);
+        return KSycocaPrivate::self()->serviceFactory()->offerRecords(offset, serviceOffersOffset);
+    }
+    return {};
+}
+
+static KService::List sycocaServices(const QList<KServiceFactory::OfferRecord> &records)
+{
+    KServiceFactory *factory = KSycocaPrivate::self()->serviceFactory();
+    KService::List lst;
+    lst.reserve(records.size());
+    for (const KServiceFactory::OfferRecord &record : records) {
+        if (KService::Ptr service = factory->service(record)) {
+            lst.append(service);
+        }
     }
     return lst;
 }
 
-static void applyFilter(KService::List &list, KApplicationTrader::FilterFunc filterFunc, bool mustShowInCurrentDesktop)
+static std::atomic<int> s_queryCacheCapacity{64};
+static std::atomic<quint64> s_queryCacheHits{0};
+static std::atomic<quint64> s_queryCacheMisses{0};
+
+// Returns all the services for the given MIME type, from the cache of the current database if possible
+static KService::List mimeTypeSycocaServices(const QString &mimeType)
+{
+    KSycoca::self()->ensureCacheValid();
+    QCache<QString, KService::List> &cache = KSycocaPrivate::self()->serviceFactory()->mimeTypeServicesCache();
+    const int capacity = s_queryCacheCapacity;
+    if (cache.maxCost() != capacity) {
+        cache.setMaxCost(capacity);
+    }
+    if (const KService::List *services = cache.object(mimeType)) {
+        ++s_queryCacheHits;
+        return *services;
+    }
+    ++s_queryCacheMisses;
+
+    const KService::List services = sycocaServices(mimeTypeSycocaOfferRecords(mimeType));
+    if (capacity > 0) {
+        cache.insert(mimeType, new KService::List(services));
+    }
+    return services;
+}
+
+static KService::Ptr firstSycocaService(const QList<KServiceFactory::OfferRecord> &records)
+{
+    // Only decode the first service, rather than the whole list of offers
+    KServiceFactory *factory = KSycocaPrivate::self()->serviceFactory();
+    for (const KServiceFactory::OfferRecord &record : records) {
+        if (KService::Ptr service = factory->service(record)) {
+            return service;
+        }
+    }
+    return KService::Ptr();
+}
+
+namespace
+{
+// Evaluates a removal function over chunks of a service list, from the calling thread and from
+// helpers in the global thread pool. The state is shared with the helpers, because helpers which
+// are only started once all the chunks are done may still run after the caller returned.
+struct ParallelFilterState {
+    KService::List services;
+    std::function<bool(const KService::Ptr &)> removeFunc;
+    std::vector<char> removed; // not std::vector<bool>: chunks are written concurrently
+    int chunkCount = 0;
+    std::atomic<int> nextChunk{0};
+    QSemaphore chunksDone;
+
+    void runChunks()
+    {
+        const qsizetype count = services.size();
+        for (int chunk = nextChunk++; chunk < chunkCount; chunk = nextChunk++) {
+            const qsizetype begin = count * chunk / chunkCount;
+            const qsizetype end = count * (chunk + 1) / chunkCount;
+            for (qsizetype i = begin; i < end; ++i) {
+                removed[i] = removeFunc(services.at(i));
+            }
+            chunksDone.release();
+        }
+    }
+};
+}
+
+static void removeServicesInParallel(KService::List &list, const std::function<bool(const KService::Ptr &)> &removeFunc)
+{
+    QThreadPool *pool = QThreadPool::globalInstance();
+    const int threadCount = std::max(1, pool->maxThreadCount());
+
+    auto state = std::make_shared<ParallelFilterState>();
+    state->services = list;
+    state->removeFunc = removeFunc;
+    state->removed.resize(list.size());
+    // A few chunks per thread, so that threads finishing early can take over from slow ones
+    state->chunkCount = int(std::min<qsizetype>(list.size(), threadCount * 4));
+
+    // The calling thread takes part too, so this completes even if the pool is busy,
+    // e.g. when called from a thread of the pool itself
+    const int helperCount = std::min(threadCount, state->chunkCount - 1);
+    for (int i = 0; i < helperCount; ++i) {
+        pool->start([state]() {
+            state->runChunks();
+        });
+    }
+    state->runChunks();
+    state->chunksDone.acquire(state->chunkCount);
+
+    KService::List kept;
+    kept.reserve(list.size());
+    for (qsizetype i = 0; i < list.size(); ++i) {
+        if (!state->removed[i]) {
+            kept.append(list.at(i));
+        }
+    }
+    list = kept;
+}
+
+static void applyFilter(KService::List &list,
+                        KApplicationTrader::FilterFunc filterFunc,
+                        bool mustShowInCurrentDesktop,
+                        KApplicationTrader::QueryOptions options = KApplicationTrader::NoQueryOptions)
 {
     if (list.isEmpty()) {
         return;
@@ -58,27 +191,221 @@ static void applyFilter(KService::List &list, KApplicationTrader::FilterFunc fil
     auto removeFunc = [&](const KService::Ptr &serv) {
         return (filterFunc && !filterFunc(serv)) || (mustShowInCurrentDesktop && !serv->showInCurrentDesktop());
     };
-    list.erase(std::remove_if(list.begin(), list.end(), removeFunc), list.end());
+    if ((options & KApplicationTrader::ParallelFilter) && list.size() > 1) {
+        removeServicesInParallel(list, removeFunc);
+    } else {
+        list.erase(std::remove_if(list.begin(), list.end(), removeFunc), list.end());
+    }
 }
 
 KService::List KApplicationTrader::query(FilterFunc filterFunc)
+{
+    return query(filterFunc, NoQueryOptions);
+}
+
+KService::List KApplicationTrader::query(FilterFunc filterFunc, QueryOptions options)
 {
     // Get all applications
     KSycoca::self()->ensureCacheValid();
     KService::List lst = KSycocaPrivate::self()->serviceFactory()->allServices();
 
-    applyFilter(lst, filterFunc, true); // true = filter out service with NotShowIn=KDE or equivalent
+    applyFilter(lst, filterFunc, true, options); // true = filter out service with NotShowIn=KDE or equivalent
 
     qCDebug(SERVICES) << "query returning" << lst.count() << "offers";
     return lst;
 }
 
+class KApplicationTrader::ConstraintPrivate : public QSharedData
+{
+public:
+    Constraint::Type type = Constraint::HasCategory;
+    QString name;
+    QString value;
+    bool boolValue = false;
+};
+
+KApplicationTrader::Constraint::Constraint(Type type)
+    : d(new ConstraintPrivate)
+{
+    d->type = type;
+}
+
+KApplicationTrader::Constraint::Constraint(const Constraint &other) = default;
+
+KApplicationTrader::Constraint &KApplicationTrader::Constraint::operator=(const Constraint &other) = default;
+
+KApplicationTrader::Constraint::~Constraint() = default;
+
+KApplicationTrader::Constraint::Type KApplicationTrader::Constraint::type() const
+{
+    return d->type;
+}
+
+QString KApplicationTrader::Constraint::name() const
+{
+    return d->name;
+}
+
+QString KApplicationTrader::Constraint::value() const
+{
+    return d->value;
+}
+
+bool KApplicationTrader::Constraint::boolValue() const
+{
+    return d->boolValue;
+}
+
+KApplicationTrader::Constraint KApplicationTrader::Constraint::hasCategory(const QString &category)
+{
+    Constraint constraint(HasCategory);
+    constraint.d->name = category;
+    return constraint;
+}
+
+KApplicationTrader::Constraint KApplicationTrader::Constraint::noDisplay(bool noDisplay)
+{
+    Constraint constraint(NoDisplay);
+    constraint.d->boolValue = noDisplay;
+    return constraint;
+}
+
+KApplicationTrader::Constraint KApplicationTrader::Constraint::terminal(bool terminal)
+{
+    Constraint constraint(Terminal);
+    constraint.d->boolValue = terminal;
+    return constraint;
+}
+
+KApplicationTrader::Constraint KApplicationTrader::Constraint::hasProperty(const QString &name)
+{
+    Constraint constraint(HasProperty);
+    constraint.d->name = name;
+    return constraint;
+}
+
+KApplicationTrader::Constraint KApplicationTrader::Constraint::propertyEquals(const QString &name, const QString &value)
+{
+    Constraint constraint(PropertyEquals);
+    constraint.d->name = name;
+    constraint.d->value = value;
+    return constraint;
+}
+
+static QBitArray rowsToBits(const QList<qint32> &rows, qsizetype rowCount)
+{
+    QBitArray bits(rowCount);
+    for (const qint32 row : rows) {
+        if (row >= 0 && row < rowCount) {
+            bits.setBit(row);
+        }
+    }
+    return bits;
+}
+
+// Loads the services of the attribute index whose row is set in @p rows
+static KService::List servicesInRows(KServiceFactory *factory, const KServiceFactory::AttributeIndex &index, const QBitArray &rows)
+{
+    KService::List lst;
+    const qsizetype rowCount = std::min(rows.size(), index.serviceOffsets.size());
+    for (qsizetype row = 0; row < rowCount; ++row) {
+        if (!rows.testBit(row)) {
+            continue;
+        }
+        if (KService::Ptr service = factory->serviceAtOffset(index.serviceOffsets.at(row))) {
+            lst.append(service);
+        }
+    }
+    return lst;
+}
+
+KService::List KApplicationTrader::query(const QList<Constraint> &constraints, FilterFunc filterFunc)
+{
+    KSycoca::self()->ensureCacheValid();
+    KServiceFactory *factory = KSycocaPrivate::self()->serviceFactory();
+    const KServiceFactory::AttributeIndex &index = factory->attributeIndex();
+    const qsizetype rowCount = index.serviceOffsets.size();
+
+    // Evaluate the constraints on the index first
+    QBitArray rows(rowCount, true);
+    for (const Constraint &constraint : constraints) {
+        switch (constraint.type()) {
+        case Constraint::HasCategory:
+            rows &= rowsToBits(factory->categoryRows(constraint.name()), rowCount);
+            break;
+        case Constraint::NoDisplay:
+            rows &= constraint.boolValue() ? index.noDisplay : ~index.noDisplay;
+            break;
+        case Constraint::Terminal:
+            rows &= constraint.boolValue() ? index.terminal : ~index.terminal;
+            break;
+        case Constraint::HasProperty:
+        case Constraint::PropertyEquals: // only the presence of the key is indexed, the value is checked below
+            rows &= rowsToBits(factory->propertyRows(constraint.name()), rowCount);
+            break;
+        }
+    }
+
+    // Then only load the matching services
+    KService::List lst = servicesInRows(factory, index, rows);
+    auto valuesDiffer = [&constraints](const KService::Ptr &service) {
+        return std::any_of(constraints.cbegin(), constraints.cend(), [&service](const Constraint &constraint) {
+            return constraint.type() == Constraint::PropertyEquals && service->property<QString>(constraint.name()) != constraint.value();
+        });
+    };
+    lst.erase(std::remove_if(lst.begin(), lst.end(), valuesDiffer), lst.end());
+
+    applyFilter(lst, filterFunc, true); // true = filter out service with NotShowIn=KDE or equivalent
+
+    qCDebug(SERVICES) << "query with" << constraints.count() << "constraints returning" << lst.count() << "offers";
+    return lst;
+}
+
+QStringList KApplicationTrader::allCategories()
+{
+    KSycoca::self()->ensureCacheValid();
+    return KSycocaPrivate::self()->serviceFactory()->allCategories();
+}
+
+KService::List KApplicationTrader::queryByCategories(const QStringList &categories, CategoryMatch match, FilterFunc filterFunc)
+{
+    if (categories.isEmpty()) {
+        return {};
+    }
+    KSycoca::self()->ensureCacheValid();
+    KServiceFactory *factory = KSycocaPrivate::self()->serviceFactory();
+    const KServiceFactory::AttributeIndex &index = factory->attributeIndex();
+    const qsizetype rowCount = index.serviceOffsets.size();
+
+    QBitArray rows(rowCount, match == MatchAllCategories);
+    for (const QString &category : categories) {
+        const QBitArray categoryBits = rowsToBits(factory->categoryRows(category), rowCount);
+        if (match == MatchAllCategories) {
+            rows &= categoryBits;
+        } else {
+            rows |= categoryBits;
+        }
+    }
+
+    KService::List lst = servicesInRows(factory, index, rows);
+
+    applyFilter(lst, filterFunc, true); // true = filter out service with NotShowIn=KDE or equivalent
+
+    qCDebug(SERVICES) << "query for categories" << categories << "returning" << lst.count() << "offers";
+    return lst;
+}
+
 KService::List KApplicationTrader::queryByMimeType(const QString &mimeType, FilterFunc filterFunc)
+{
+    return queryByMimeType(mimeType, filterFunc, NoQueryOptions);
+}
+
+KService::List KApplicationTrader::queryByMimeType(const QString &mimeType, FilterFunc filterFunc, QueryOptions options)
 {
     // Get all services of this MIME type.
-    KService::List lst = mimeTypeSycocaServiceOffers(mimeType);
+    KService::List lst = mimeTypeSycocaServices(mimeType);
 
-    applyFilter(lst, filterFunc, false); // false = allow NotShowIn=KDE services listed in mimeapps.list
+    applyFilter(lst, filterFunc, false, options); // false = allow NotShowIn=KDE services listed in mimeapps.list
 
     qCDebug(SERVICES) << "query for mimeType" << mimeType << "returning" << lst.count() << "offers";
     return lst;
@@ -86,11 +413,284 @@ KService::List KApplicationTrader::queryByMimeType(const QString &mimeType, Filt
 
 KService::Ptr KApplicationTrader::preferredService(const QString &mimeType)
 {
-    const KService::List offers = queryByMimeType(mimeType);
-    if (!offers.isEmpty()) {
-        return offers.at(0);
+    KSycoca::self()->ensureCacheValid();
+    const int mimeTypeId = KSycocaPrivate::self()->mimeTypeFactory()->mimeTypeId(mimeType);
+    if (mimeTypeId != -1) {
+        // Precomputed by kbuildsycoca
+        KServiceFactory *factory = KSycocaPrivate::self()->serviceFactory();
+        const int serviceOffset = factory->preferredServiceOffset(mimeTypeId);
+        return serviceOffset ? factory->serviceAtOffset(serviceOffset) : KService::Ptr();
     }
-    return KService::Ptr();
+    // Scheme handlers, and unknown MIME types (for the warning)
+    return firstSycocaService(mimeTypeSycocaOfferRecords(mimeType));
+}
+
+KApplicationTrader::QueryCacheStatistics KApplicationTrader::queryCacheStatistics()
+{
+    QueryCacheStatistics statistics;
+    statistics.hits = s_queryCacheHits;
+    statistics.misses = s_queryCacheMisses;
+    return statistics;
+}
+
+void KApplicationTrader::setQueryCacheCapacity(int capacity)
+{
+    s_queryCacheCapacity = std::max(0, capacity);
+}
+
+KService::List KApplicationTrader::queryBySchemeHandler(const QString &scheme, FilterFunc filterFunc)
+{
+    KService::List lst = sycocaServices(schemeHandlerSycocaOfferRecords(scheme));
+
+    applyFilter(lst, filterFunc, false); // false = allow NotShowIn=KDE services listed in mimeapps.list
+
+    qCDebug(SERVICES) << "query for scheme" << scheme << "returning" << lst.count() << "offers";
+    return lst;
+}
+
+KService::Ptr KApplicationTrader::preferredSchemeHandler(const QString &scheme)
+{
+    return firstSycocaService(schemeHandlerSycocaOfferRecords(scheme));
+}
+
+namespace
+{
+struct SearchCandidate {
+    qint32 row;
+    int score;
+};
+
+// Weight of the best field in @p fields, a combination of KServiceFactory::SearchField flags
+int searchFieldWeight(quint32 fields)
+{
+    if (fields & KServiceFactory::SearchName) {
+        return 8;
+    } else if (fields & KServiceFactory::SearchGenericName) {
+        return 4;
+    } else if (fields & KServiceFactory::SearchKeywords) {
+        return 2;
+    } else if (fields & KServiceFactory::SearchComment) {
+        return 1;
+    }
+    return 0;
+}
+
+const int s_namePrefixBonus = 8;
+
+// Intersects two lists of postings sorted by row, combining the field flags with @p combine
+template<typename Combine>
+QList<quint32> intersectPostings(const QList<quint32> &lhs, const QList<quint32> &rhs, Combine combine)
+{
+    QList<quint32> result;
+    auto lit = lhs.cbegin();
+    auto rit = rhs.cbegin();
+    while (lit != lhs.cend() && rit != rhs.cend()) {
+        const quint32 lrow = *lit >> 4;
+        const quint32 rrow = *rit >> 4;
+        if (lrow < rrow) {
+            ++lit;
+        } else if (rrow < lrow) {
+            ++rit;
+        } else {
+            const quint32 fields = combine(*lit & 0xf, *rit & 0xf);
+            if (fields) {
+                result.append((lrow << 4) | fields);
+            }
+            ++lit;
+            ++rit;
+        }
+    }
+    return result;
+}
+
+// Returns true if one of @p words matches @p token, see KApplicationTrader::search
+bool wordsMatch(const QStringList &words, const QString &token)
+{
+    return std::any_of(words.cbegin(), words.cend(), [&token](const QString &word) {
+        return token.size() >= 3 ? word.contains(token) : word.startsWith(token);
+    });
+}
+
+// The exact score of @p service, computed the same way as the estimation from the index; 0 if it doesn't match
+int searchScore(const KService::Ptr &service, const QStringList &tokens)
+{
+    const QStringList nameWords = KServiceUtilPrivate::searchWords(service->name());
+    const QStringList fieldWords[] = {
+        nameWords,
+        KServiceUtilPrivate::searchWords(service->genericName()),
+        KServiceUtilPrivate::searchWords(service->keywords().join(QLatin1Char(' '))),
+        KServiceUtilPrivate::searchWords(service->comment()),
+    };
+    const quint32 fieldFlags[] = {KServiceFactory::SearchName, KServiceFactory::SearchGenericName, KServiceFactory::SearchKeywords, KServiceFactory::SearchComment};
+
+    int score = 0;
+    for (const QString &token : tokens) {
+        int weight = 0;
+        for (int i = 0; i < 4 && !weight; ++i) {
+            if (wordsMatch(fieldWords[i], token)) {
+                weight = searchFieldWeight(fieldFlags[i]);
+            }
+        }
+        if (!weight) {
+            return 0;
+        }
+        score += weight;
+        if (std::any_of(nameWords.cbegin(), nameWords.cend(), [&token](const QString &word) {
+                return word.startsWith(token);
+            })) {
+            score += s_namePrefixBonus;
+        }
+    }
+    return score;
+}
+}
+
+KService::List KApplicationTrader::search(const QString &query, int limit)
+{
+    const QStringList tokens = KServiceUtilPrivate::searchWords(query);
+    if (tokens.isEmpty() || limit == 0) {
+        return {};
+    }
+
+    KSycoca::self()->ensureCacheValid();
+    KServiceFactory *factory = KSycocaPrivate::self()->serviceFactory();
+    const KServiceFactory::AttributeIndex &index = factory->attributeIndex();
+
+    // Find the candidates and an upper bound of their score, using the trigram index only
+    QList<quint32> candidates; // (row << 4 | unused)
+    QHash<qint32, int> estimatedScores;
+    bool first = true;
+    for (const QString &token : tokens) {
+        const QChar startOfWord;
+        const quint64 prefixTrigram = token.size() == 1 ? KServiceUtilPrivate::searchTrigram(startOfWord, startOfWord, token.at(0))
+                                                        : KServiceUtilPrivate::searchTrigram(startOfWord, token.at(0), token.at(1));
+        const QList<quint32> prefixPostings = factory->searchPostings(prefixTrigram);
+
+        // Rows containing all the trigrams of the token, with the fields which could contain the token
+        QList<quint32> tokenPostings;
+        if (token.size() < 3) {
+            tokenPostings = prefixPostings; // short tokens only match the start of words
+        } else {
+            for (qsizetype i = 0; i + 2 < token.size(); ++i) {
+                const QList<quint32> postings = factory->searchPostings(KServiceUtilPrivate::searchTrigram(token.at(i), token.at(i + 1), token.at(i + 2)));
+                tokenPostings = i == 0 ? postings : intersectPostings(tokenPostings, postings, std::bit_and<quint32>());
+                if (tokenPostings.isEmpty()) {
+                    return {};
+                }
+            }
+        }
+
+        // Rows which could have a word starting with the token in their name
+        const QList<quint32> namePrefixPostings = intersectPostings(tokenPostings, prefixPostings, [](quint32, quint32 prefixFields) {
+            return prefixFields & KServiceFactory::SearchName;
+        });
+        QSet<qint32> namePrefixRows;
+        for (const quint32 posting : namePrefixPostings) {
+            namePrefixRows.insert(posting >> 4);
+        }
+
+        candidates = first ? tokenPostings : intersectPostings(candidates, tokenPostings, [](quint32, quint32 fields) {
+            return fields;
+        });
+        first = false;
+        if (candidates.isEmpty()) {
+            return {};
+        }
+        for (const quint32 posting : std::as_const(tokenPostings)) {
+            const qint32 row = posting >> 4;
+            estimatedScores[row] += searchFieldWeight(posting & 0xf) + (namePrefixRows.contains(row) ? s_namePrefixBonus : 0);
+        }
+    }
+
+    std::vector<SearchCandidate> sortedCandidates;
+    sortedCandidates.reserve(candidates.size());
+    for (const quint32 posting : std::as_const(candidates)) {
+        const qint32 row = posting >> 4;
+        if (row >= index.serviceOffsets.size() || index.noDisplay.testBit(row)) {
+            continue;
+        }
+        sortedCandidates.push_back({row, estimatedScores.value(row)});
+    }
+    auto byScore = [](const SearchCandidate &lhs, const SearchCandidate &rhs) {
+        return lhs.score > rhs.score || (lhs.score == rhs.score && lhs.row < rhs.row);
+    };
+    std::sort(sortedCandidates.begin(), sortedCandidates.end(), byScore);
+
+    // Load the candidates, best estimation first, and stop as soon as no remaining candidate can make it into the results
+    std::vector<SearchCandidate> results;
+    QHash<qint32, KService::Ptr> services;
+    for (const SearchCandidate &candidate : sortedCandidates) {
+        if (limit > 0 && int(results.size()) >= limit && results.at(limit - 1).score >= candidate.score) {
+            break;
+        }
+        KService::Ptr service = factory->serviceAtOffset(index.serviceOffsets.at(candidate.row));
+        if (!service || service->noDisplay()) {
+            continue;
+        }
+        const int score = searchScore(service, tokens);
+        if (!score) {
+            continue; // all the trigrams are there, but not the token itself
+        }
+        const SearchCandidate result{candidate.row, score};
+        results.insert(std::upper_bound(results.begin(), results.end(), result, byScore), result);
+        services.insert(candidate.row, service);
+    }
+
+    KService::List lst;
+    const int count = limit > 0 ? std::min(limit, int(results.size())) : int(results.size());
+    lst.reserve(count);
+    for (int i = 0; i < count; ++i) {
+        lst.append(services.value(results.at(i).row));
+    }
+    qCDebug(SERVICES) << "search for" << query << "returning" << lst.count() << "results";
+    return lst;
+}
+
+QList<KApplicationTrader::SubsequenceMatch> KApplicationTrader::matchSubsequence(const QString &pattern, int limit)
+{
+    if (pattern.isEmpty() || limit == 0) {
+        return {};
+    }
+    KSycoca::self()->ensureCacheValid();
+    KServiceFactory *factory = KSycocaPrivate::self()->serviceFactory();
+    const KServiceFactory::AttributeIndex &index = factory->attributeIndex();
+    const KSubsequenceMatcher::NameTable &table = factory->nameTable();
+    if (table.count() != index.serviceOffsets.count()) {
+        return {};
+    }
+
+    const QList<KSubsequenceMatcher::Match> matches = KSubsequenceMatcher::matchAll(pattern, table, index.noDisplay);
+    QList<SubsequenceMatch> results;
+    for (const KSubsequenceMatcher::Match &match : matches) {
+        KService::Ptr service = factory->serviceAtOffset(index.serviceOffsets.at(match.row));
+        if (!service || service->noDisplay()) {
+            continue;
+        }
+        results.append(SubsequenceMatch{service, match.score, match.positions});
+        if (limit > 0 && results.count() >= limit) {
+            break;
+        }
+    }
+    return results;
+}
+
+QList<KApplicationTrader::SubsequenceMatch> KApplicationTrader::matchSubsequence(const QString &pattern, const KService::List &services, int limit)
+{
+    if (pattern.isEmpty() || limit == 0) {
+        return {};
+    }
+    KSubsequenceMatcher::NameTable table;
+    for (const KService::Ptr &service : services) {
+        table.append(service->name());
+    }
+
+    const QList<KSubsequenceMatcher::Match> matches = KSubsequenceMatcher::matchAll(pattern, table, QBitArray(), limit);
+    QList<SubsequenceMatch> results;
+    results.reserve(matches.count());
+    for (const KSubsequenceMatcher::Match &match : matches) {
+        results.append(SubsequenceMatch{services.at(match.row), match.score, match.positions});
+    }
+    return results;
 }
 
 void KApplicationTrader::setPreferredService(const QString &mimeType, const KService::Ptr service)
@@ -9,6 +9,8 @@
 #ifndef KAPPLICATIONTRADER_H
 #define KAPPLICATIONTRADER_H
 
+#include <QFlags>
+#include <QSharedDataPointer>
 #include <functional>
 #include <kservice.h>
 
@@ -49,6 +51,163 @@ using FilterFunc = std::function<bool(const KService::Ptr &)>;
  */
 KSERVICE_EXPORT KService::List query(FilterFunc filterFunc);
 
+/**
+ * Options for query(FilterFunc, QueryOptions) and queryByMimeType(const QString &, FilterFunc, QueryOptions)
+ * @since 6.12
+ */
+enum QueryOption {
+    NoQueryOptions = 0, ///< the filter function is called on the calling thread
+    /**
+     * The filter function is called in parallel from several threads of QThreadPool::globalInstance(),
+     * each thread handling a part of the services. This helps when the filter function is expensive,
+     * e.g. when it looks for the executable of the service with QStandardPaths::findExecutable().
+     *
+     * The filter function must then be thread-safe: it must not modify state shared with other calls
+     * without synchronization, and must not use objects which live in the calling thread, such as
+     * QObjects, widgets or a KSycoca instance (do not call KService::serviceByDesktopName() and similar
+     * from it). The services passed to it can be used safely, as long as they are not modified.
+     *
+     * The result is the same, and in the same order, as without this option.
+     */
+    ParallelFilter = 1,
+};
+Q_DECLARE_FLAGS(QueryOptions, QueryOption)
+
+/**
+ * This method returns a list of services (applications) that match a given filter.
+ *
+ * @param filter a callback function that returns @c true if the application
+ * should be selected and @c false if it should be skipped.
+ * @param options how to call @p filter, see QueryOption
+ *
+ * @return A list of services that satisfy the query
+ * @since 6.12
+ */
+KSERVICE_EXPORT KService::List query(FilterFunc filterFunc, QueryOptions options);
+
+class ConstraintPrivate;
+
+/**
+ * @class Constraint kapplicationtrader.h <KApplicationTrader>
+ *
+ * A condition on applications, to be used with query(const QList<Constraint> &, FilterFunc).
+ * Constraints are created with the static functions of this class.
+ *
+ * Unlike a FilterFunc, constraints are evaluated against an index written by kbuildsycoca,
+ * so only the applications satisfying them are loaded.
+ *
+ * @since 6.12
+ */
+class KSERVICE_EXPORT Constraint
+{
+public:
+    enum Type {
+        HasCategory, ///< The Categories key contains name()
+        NoDisplay, ///< The NoDisplay key is set to boolValue()
+        Terminal, ///< The Terminal key is set to boolValue()
+        HasProperty, ///< The desktop file has the key name(), see KService::property()
+        PropertyEquals, ///< The key name() is set to value(), see KService::property()
+    };
+
+    /**
+     * Selects the applications listing @p category in their Categories key
+     */
+    static Constraint hasCategory(const QString &category);
+    /**
+     * Selects the applications whose NoDisplay key is @p noDisplay.
+     * Note that unlike KService::noDisplay(), this doesn't take OnlyShowIn/NotShowIn into account.
+     */
+    static Constraint noDisplay(bool noDisplay);
+    /**
+     * Selects the applications whose Terminal key is @p terminal
+     */
+    static Constraint terminal(bool terminal);
+    /**
+     * Selects the applications having the key @p name.
+     * This only applies to the keys which aren't available through a dedicated KService getter.
+     */
+    static Constraint hasProperty(const QString &name);
+    /**
+     * Selects the applications having the key @p name set to @p value.
+     * This only applies to the keys which aren't available through a dedicated KService getter.
+     */
+    static Constraint propertyEquals(const QString &name, const QString &value);
+
+    Constraint(const Constraint &other);
+    Constraint &operator=(const Constraint &other);
+    ~Constraint();
+
+    /**
+     * @return what this constraint checks
+     */
+    Type type() const;
+    /**
+     * @return the category or the key checked, empty for NoDisplay and Terminal
+     */
+    QString name() const;
+    /**
+     * @return the value expected for the key, only set for PropertyEquals
+     */
+    QString value() const;
+    /**
+     * @return the value expected for NoDisplay and Terminal
+     */
+    bool boolValue() const;
+
+private:
+    KSERVICE_NO_EXPORT explicit Constraint(Type type);
+    QSharedDataPointer<ConstraintPrivate> d;
+};
+
+/**
+ * This method returns a list of services (applications) that satisfy all the given @p constraints,
+ * and optionally a filter function.
+ *
+ * Contrary to query(FilterFunc), only the applications satisfying the constraints are loaded,
+ * before @p filterFunc is called on them. Prefer this method whenever the selection can be
+ * (at least partially) expressed as constraints.
+ *
+ * @param constraints the constraints that the applications must all satisfy
+ * @param filterFunc an optional callback function that returns @c true if the application
+ * should be selected and @c false if it should be skipped.
+ *
+ * @return A list of services that satisfy the query, in the same order as query(FilterFunc)
+ * @since 6.12
+ */
+KSERVICE_EXPORT KService::List query(const QList<Constraint> &constraints, FilterFunc filterFunc = {});
+
+/**
+ * How queryByCategories() combines the categories
+ * @since 6.12
+ */
+enum CategoryMatch {
+    MatchAllCategories, ///< applications must have all the categories
+    MatchAnyCategory, ///< applications must have at least one of the categories
+};
+
+/**
+ * @return the categories of all the applications (the Categories key of their desktop file), sorted
+ * @since 6.12
+ */
+KSERVICE_EXPORT QStringList allCategories();
+
+/**
+ * This method returns the applications having all, or any, of the given @p categories.
+ *
+ * Categories are looked up in an index written by kbuildsycoca, and only the
+ * matching applications are loaded, so this is suitable for grouping applications
+ * by category, e.g. together with allCategories().
+ *
+ * @param categories categories like "Office" or "Graphics"
+ * @param match whether applications must have all the categories, or any of them
+ * @param filterFunc an optional callback function that returns @c true if the application
+ * should be selected and @c false if it should be skipped.
+ *
+ * @return A list of services that satisfy the query, in the same order as query(FilterFunc)
+ * @since 6.12
+ */
+KSERVICE_EXPORT KService::List queryByCategories(const QStringList &categories, CategoryMatch match = MatchAllCategories, FilterFunc filterFunc = {});
+
 /**
  * This method returns a list of services (applications) which are associated with a given MIME type.
  *
@@ -64,10 +223,28 @@ KSERVICE_EXPORT KService::List query(FilterFunc filterFunc);
  */
 KSERVICE_EXPORT KService::List queryByMimeType(const QString &mimeType, FilterFunc filterFunc = {});
 
+/**
+ * This method returns a list of services (applications) which are associated with a given MIME type.
+ *
+ * This is the same as queryByMimeType(mimeType, filterFunc), calling @p filterFunc as specified by @p options.
+ *
+ * @param mimeType a MIME type like 'text/plain' or 'text/html'
+ * @param filter a callback function that returns @c true if the application
+ * should be selected and @c false if it should be skipped.
+ * @param options how to call @p filter, see QueryOption
+ *
+ * @return A list of services that satisfy the query, sorted by preference
+ * (preferred service first)
+ * @since 6.12
+ */
+KSERVICE_EXPORT KService::List queryByMimeType(const QString &mimeType, FilterFunc filterFunc, QueryOptions options);
+
 /**
  * Returns the preferred service for @p mimeType
  *
  * This a convenience method for queryByMimeType(mimeType).at(0), with a check for empty.
+ * The preferred service of each MIME type is determined when the database is built,
+ * so only that service is loaded.
  *
  * @param mimeType the MIME type (see query())
  * @return the preferred service, or @c nullptr if no service is available
@@ -75,6 +252,127 @@ KSERVICE_EXPORT KService::List queryByMimeType(const QString &mimeType, FilterFu
  */
 KSERVICE_EXPORT KService::Ptr preferredService(const QString &mimeType);
 
+/**
+ * Statistics about the cache of queryByMimeType(), see queryCacheStatistics()
+ * @since 6.12
+ */
+struct KSERVICE_EXPORT QueryCacheStatistics {
+    quint64 hits = 0; ///< number of queries answered from the cache
+    quint64 misses = 0; ///< number of queries which had to read the database
+};
+
+/**
+ * The services associated with the MIME types queried most recently are kept in a cache,
+ * so that asking again for the same MIME type, e.g. for each file of a directory listing,
+ * doesn't read the database again. The cache is emptied when the database changes.
+ *
+ * The services returned from the cache are shared between the calls, do not modify them.
+ *
+ * @return the number of hits and misses of the cache since the start of the application,
+ * counted over all threads
+ * @see setQueryCacheCapacity
+ * @since 6.12
+ */
+KSERVICE_EXPORT QueryCacheStatistics queryCacheStatistics();
+
+/**
+ * Sets the number of MIME types kept in the cache of queryByMimeType(),
+ * in each thread. The default is 64. A capacity of 0 disables the cache.
+ * @see queryCacheStatistics
+ * @since 6.12
+ */
+KSERVICE_EXPORT void setQueryCacheCapacity(int capacity);
+
+/**
+ * This method returns a list of services (applications) which handle URLs with the scheme @p scheme,
+ * i.e. which are associated with the "x-scheme-handler/<scheme>" MIME type.
+ *
+ * This gives the same result as queryByMimeType() with "x-scheme-handler/" + @p scheme,
+ * but it uses a dedicated index, so it's the fastest way to find the handlers of a URL.
+ *
+ * @param scheme a URL scheme like 'mailto' or 'https'
+ * @param filter a callback function that returns @c true if the application
+ * should be selected and @c false if it should be skipped.
+ *
+ * @return A list of services that satisfy the query, sorted by preference
+ * (preferred service first)
+ * @since 6.12
+ */
+KSERVICE_EXPORT KService::List queryBySchemeHandler(const QString &scheme, FilterFunc filterFunc = {});
+
+/**
+ * Returns the preferred handler for URLs with the scheme @p scheme
+ *
+ * This a convenience method for queryBySchemeHandler(scheme).at(0), with a check for empty.
+ *
+ * @param scheme a URL scheme like 'mailto' or 'https'
+ * @return the preferred service, or @c nullptr if no service handles that scheme
+ * @since 6.12
+ */
+KSERVICE_EXPORT KService::Ptr preferredSchemeHandler(const QString &scheme);
+
+/**
+ * Searches applications the way application launchers do, using a full-text index written by kbuildsycoca.
+ *
+ * The query is split into words, and each word must be found in the name, generic name,
+ * keywords or comment of the application. Words of three characters or more can match anywhere
+ * inside a word, shorter ones only at the start of a word. The comparison ignores case and diacritics
+ * (e.g. "editeur" finds "Éditeur").
+ *
+ * Results are ranked: a match in the name ranks higher than one in the generic name, then the keywords,
+ * then the comment, and matching the start of a word in the name ranks higher still.
+ * Applications which should not be shown in menus (see KService::noDisplay()) are skipped.
+ *
+ * Only the best candidates are loaded, so this is fast enough to be called on every keystroke.
+ *
+ * @param query the text typed by the user
+ * @param limit the maximum number of results, or -1 for no limit
+ * @return the matching applications, best match first
+ * @since 6.12
+ */
+KSERVICE_EXPORT KService::List search(const QString &query, int limit = -1);
+
+/**
+ * A match found by matchSubsequence()
+ * @since 6.12
+ */
+struct KSERVICE_EXPORT SubsequenceMatch {
+    KService::Ptr service; ///< the matching application
+    int score = 0; ///< the score of the match, higher is better
+    QList<int> positions; ///< the positions of the matched characters in service->name(), e.g. for highlighting
+};
+
+/**
+ * Matches @p pattern against the names of all applications, ignoring case, the way
+ * isSubsequence() does. For instance "libremath" matches "LibreOffice Math".
+ *
+ * Matches at the start of the name or of a word and consecutive characters score higher.
+ * Applications which should not be shown in menus (see KService::noDisplay()) are skipped.
+ *
+ * The names are matched in one pass over a table written by kbuildsycoca, and only
+ * the matching applications are loaded, so this can be called on every keystroke.
+ *
+ * @param pattern the text typed by the user
+ * @param limit the maximum number of results, or -1 for no limit
+ * @return the matches, best match first
+ * @since 6.12
+ */
+KSERVICE_EXPORT QList<SubsequenceMatch> matchSubsequence(const QString &pattern, int limit = -1);
+
+/**
+ * Matches @p pattern against the names of @p services, e.g. the entries of a menu.
+ *
+ * This is the same as matchSubsequence(pattern, limit), for a given list of services.
+ * Services which should not be shown in menus are not skipped.
+ *
+ * @param pattern the text typed by the user
+ * @param services the services to match
+ * @param limit the maximum number of results, or -1 for no limit
+ * @return the matches, best match first, then in the order of @p services
+ * @since 6.12
+ */
+KSERVICE_EXPORT QList<SubsequenceMatch> matchSubsequence(const QString &pattern, const KService::List &services, int limit = -1);
+
 /**
  * Changes the preferred service for @p mimeType to @p service
  *
@@ -97,4 +395,6 @@ KSERVICE_EXPORT void setPreferredService(const QString &mimeType, const KService
 KSERVICE_EXPORT bool isSubsequence(const QString &pattern, const QString &text, Qt::CaseSensitivity cs = Qt::CaseSensitive);
 }
 
+Q_DECLARE_OPERATORS_FOR_FLAGS(KApplicationTrader::QueryOptions)
+
 #endif
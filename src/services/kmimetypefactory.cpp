@@ -13,15 +13,41 @@
 #include <ksycoca.h>
 #include <ksycocadict_p.h>
 
+#include <algorithm>
+
 extern int servicesDebugArea();
 
 KMimeTypeFactory::KMimeTypeFactory(KSycoca *db)
     : KSycocaFactory(KST_KMimeTypeFactory, db)
+    , m_schemeDict(nullptr)
+    , m_schemeDictOffset(0)
+    , m_namesDict(nullptr)
+    , m_namesDictOffset(0)
 {
+    if (!sycoca()->isBuilding()) {
+        QDataStream *str = stream();
+        if (!str) {
+            return;
+        }
+        // Read Header
+        qint32 i;
+        (*str) >> i;
+        m_schemeDictOffset = i;
+        (*str) >> i;
+        m_namesDictOffset = i;
+
+        const qint64 saveOffset = str->device()->pos();
+        // Init index tables
+        m_schemeDict = new KSycocaDict(str, m_schemeDictOffset);
+        m_namesDict = new KSycocaDict(str, m_namesDictOffset);
+        str->device()->seek(saveOffset);
+    }
 }
 
 KMimeTypeFactory::~KMimeTypeFactory()
 {
+    delete m_schemeDict;
+    delete m_namesDict;
 }
 
 int KMimeTypeFactory::entryOffset(const QString &mimeTypeName)
@@ -53,6 +79,101 @@ int KMimeTypeFactory::serviceOffersOffset(const QString &mimeTypeName)
     return newMimeType->serviceOffersOffset();
 }
 
+int KMimeTypeFactory::schemeHandlerEntryOffset(const QString &scheme, int &serviceOffersOffset)
+{
+    serviceOffersOffset = -1;
+    if (!m_schemeDict) {
+        return 0; // Error!
+    }
+    assert(!sycoca()->isBuilding());
+    const QString lowerScheme = scheme.toLower();
+    const int offset = m_schemeDict->find_string(lowerScheme);
+    if (!offset) {
+        return 0; // Not found
+    }
+
+    MimeTypeEntry::Ptr entry(createEntry(offset));
+    // Check whether the dictionary was right.
+    if (!entry || entry->name() != QLatin1String("x-scheme-handler/") + lowerScheme) {
+        return 0;
+    }
+    serviceOffersOffset = entry->serviceOffersOffset();
+    return offset;
+}
+
+bool KMimeTypeFactory::findNamesEntry(const QString &mimeTypeName, MimeTypeNamesEntry &entry)
+{
+    if (!m_namesDict) {
+        return false; // Error!
+    }
+    assert(!sycoca()->isBuilding());
+    const QString key = mimeTypeName.toLower();
+    const int offset = m_namesDict->find_string(key);
+    if (!offset) {
+        return false; // Not found
+    }
+
+    KSycocaType type;
+    QDataStream *str = sycoca()->findEntry(offset, type);
+    if (!str || type != KST_KMimeTypeNames) {
+        qCWarning(SERVICES) << "KMimeTypeFactory: unexpected object entry in KSycoca database (type=" << int(type) << ")";
+        return false;
+    }
+    QStringList keys;
+    (*str) >> entry.canonicalName >> entry.id >> keys >> entry.parents;
+    if (str->status() != QDataStream::Ok || entry.id < 0) {
+        qCWarning(SERVICES) << "KMimeTypeFactory: corrupt MIME type names in KSycoca database!";
+        KSycoca::flagError();
+        return false;
+    }
+    // Check whether the dictionary was right.
+    return keys.contains(key);
+}
+
+QString KMimeTypeFactory::canonicalName(const QString &mimeTypeName)
+{
+    MimeTypeNamesEntry entry;
+    return findNamesEntry(mimeTypeName, entry) ? entry.canonicalName : QString();
+}
+
+int KMimeTypeFactory::mimeTypeId(const QString &mimeTypeName)
+{
+    MimeTypeNamesEntry entry;
+    return findNamesEntry(mimeTypeName, entry) ? entry.id : -1;
+}
+
+QStringList KMimeTypeFactory::parents(const QString &mimeTypeName)
+{
+    MimeTypeNamesEntry entry;
+    if (!findNamesEntry(mimeTypeName, entry) || entry.canonicalName != mimeTypeName) {
+        return QStringList();
+    }
+    return entry.parents;
+}
+
+// Same order as QMimeType::allAncestors(): all the parents, then their own ancestors
+static void collectAncestors(KMimeTypeFactory *factory, const QString &mimeTypeName, QStringList &ancestors)
+{
+    const QStringList parents = factory->parents(mimeTypeName);
+    QStringList newParents;
+    for (const QString &parent : parents) {
+        if (!ancestors.contains(parent)) {
+            ancestors.append(parent);
+            newParents.append(parent);
+        }
+    }
+    for (const QString &parent : std::as_const(newParents)) {
+        collectAncestors(factory, parent, ancestors);
+    }
+}
+
+QStringList KMimeTypeFactory::allAncestors(const QString &mimeTypeName)
+{
+    QStringList ancestors;
+    collectAncestors(this, mimeTypeName, ancestors);
+    return ancestors;
+}
+
 KMimeTypeFactory::MimeTypeEntry *KMimeTypeFactory::createEntry(int offset) const
 {
     KSycocaType type;
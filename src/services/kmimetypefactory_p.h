@@ -11,20 +11,25 @@
 
 #include <assert.h>
 
+#include <QHash>
 #include <QStringList>
 
 #include "ksycocafactory_p.h"
 
 class KSycoca;
+class KSycocaDict;
 
 /**
  * @internal  - this header is not installed
  *
  * A sycoca factory for MIME type entries
- * This is only used to point to the "service offers" in ksycoca for each MIME type.
+ * This is only used to point to the "service offers" in ksycoca for each MIME type,
+ * and to resolve MIME type names without QMimeDatabase.
  * @see KMimeType
+ *
+ * Exported for unit tests
  */
-class KMimeTypeFactory : public KSycocaFactory
+class KSERVICE_EXPORT KMimeTypeFactory : public KSycocaFactory
 {
     K_SYCOCAFACTORY(KST_KMimeTypeFactory)
 public:
@@ -54,6 +59,41 @@ public:
      */
     int serviceOffersOffset(const QString &mimeTypeName);
 
+    /**
+     * Returns the offset of the "x-scheme-handler/<scheme>" entry for the URL scheme @p scheme,
+     * or 0 if no application handles that scheme.
+     * This uses a dedicated index, so no QMimeDatabase lookup is involved.
+     * @param serviceOffersOffset set to the offset into the service offers for that entry
+     */
+    int schemeHandlerEntryOffset(const QString &scheme, int &serviceOffersOffset);
+
+    /**
+     * Returns the canonical name of @p mimeTypeName, which can be an alias,
+     * like QMimeDatabase::mimeTypeForName(mimeTypeName).name() did when the database was built,
+     * or an empty string if the MIME type is unknown.
+     * This uses a table written by kbuildsycoca, so no QMimeDatabase lookup is involved.
+     */
+    QString canonicalName(const QString &mimeTypeName);
+
+    /**
+     * Returns a dense id, between 0 and the number of MIME types known to QMimeDatabase
+     * when the database was built, for @p mimeTypeName, which can be an alias,
+     * or -1 if the MIME type is unknown. A MIME type and its aliases have the same id.
+     */
+    int mimeTypeId(const QString &mimeTypeName);
+
+    /**
+     * Returns the direct parents of the MIME type @p mimeTypeName (a canonical name),
+     * like QMimeType::parentMimeTypes().
+     */
+    QStringList parents(const QString &mimeTypeName);
+
+    /**
+     * Returns all the ancestors of the MIME type @p mimeTypeName (a canonical name),
+     * nearest first, like QMimeType::allAncestors().
+     */
+    QStringList allAncestors(const QString &mimeTypeName);
+
     /**
      * Returns the directories to watch for this factory.
      */
@@ -93,7 +133,33 @@ public: // public for KBuildServiceFactory
 protected:
     MimeTypeEntry *createEntry(int offset) const override;
 
+    // Used by KBuildMimeTypeFactory too
+    KSycocaDict *m_schemeDict;
+    int m_schemeDictOffset;
+    KSycocaDict *m_namesDict;
+    int m_namesDictOffset;
+
+    // Names of the MIME types known to QMimeDatabase at build time
+    struct MimeTypeNames {
+        QHash<QString, qint32> ids; // lowercase name or alias -> id of the MIME type
+        QStringList canonicalNames; // id -> canonical name, sorted
+        QHash<QString, QStringList> parents; // canonical name -> direct parents
+    };
+
 private:
+    // One KST_KMimeTypeNames entry, as saved by KBuildMimeTypeFactory
+    struct MimeTypeNamesEntry {
+        qint32 id = -1;
+        QString canonicalName;
+        QStringList parents;
+    };
+
+    /**
+     * Reads the entry of the MIME type or alias @p mimeTypeName from the database.
+     * @return false if the MIME type is unknown
+     */
+    bool findNamesEntry(const QString &mimeTypeName, MimeTypeNamesEntry &entry);
+
     // d pointer: useless since this header is not installed
     // class KMimeTypeFactoryPrivate* d;
 };
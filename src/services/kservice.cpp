@@ -127,6 +127,13 @@ void KServicePrivate::init(const KDesktopFile *config, KService *q)
 
     if (entryMap.remove(QStringLiteral("MimeType"))) {
         m_mimeTypes = desktopGroup.readXdgListEntry("MimeType");
+
+        const QLatin1String schemeHandlerPrefix("x-scheme-handler/");
+        for (const QString &mimeName : std::as_const(m_mimeTypes)) {
+            if (mimeName.startsWith(schemeHandlerPrefix)) {
+                m_schemeHandlers.append(mimeName.mid(schemeHandlerPrefix.size()));
+            }
+        }
     }
 
     m_strDesktopEntryName = _name;
@@ -232,7 +239,8 @@ void KServicePrivate::load(QDataStream &s)
       >> m_lstKeywords >> m_strGenName
       >> categories >> menuId >> m_actions
       >> m_lstFormFactors
-      >> m_untranslatedName >> m_untranslatedGenericName >> m_mimeTypes;
+      >> m_untranslatedName >> m_untranslatedGenericName >> m_mimeTypes
+      >> m_mimeTypeIds >> m_schemeHandlers;
     // clang-format on
 
     m_bAllowAsDefault = bool(def);
@@ -254,7 +262,8 @@ void KServicePrivate::save(QDataStream &s)
     // number in ksycoca.cpp
     s << m_strType << m_strName << m_strExec << m_strIcon << term << m_strTerminalOptions << m_strWorkingDirectory << m_strComment << def << m_mapProps
       << m_strLibrary << dst << m_strDesktopEntryName << m_lstKeywords << m_strGenName << categories << menuId << m_actions << m_lstFormFactors
-      << m_untranslatedName << m_untranslatedGenericName << m_mimeTypes;
+      << m_untranslatedName << m_untranslatedGenericName << m_mimeTypes << m_mimeTypeIds
+      << m_schemeHandlers;
 }
 
 ////
@@ -310,23 +319,19 @@ KService::~KService()
 bool KService::hasMimeType(const QString &mimeType) const
 {
     Q_D(const KService);
-    QMimeDatabase db;
-    const QString mime = db.mimeTypeForName(mimeType).name();
-    if (mime.isEmpty()) {
-        return false;
-    }
     int serviceOffset = offset();
     if (serviceOffset) {
         KSycoca::self()->ensureCacheValid();
         KMimeTypeFactory *factory = KSycocaPrivate::self()->mimeTypeFactory();
-        const int mimeOffset = factory->entryOffset(mime);
-        const int serviceOffersOffset = factory->serviceOffersOffset(mime);
-        if (serviceOffersOffset == -1) {
-            return false;
-        }
-        return KSycocaPrivate::self()->serviceFactory()->hasOffer(mimeOffset, serviceOffersOffset, serviceOffset);
+        const int mimeTypeId = factory->mimeTypeId(mimeType); // resolves aliases, without QMimeDatabase
+        return mimeTypeId != -1 && std::binary_search(d->m_mimeTypeIds.cbegin(), d->m_mimeTypeIds.cend(), mimeTypeId);
     }
 
+    QMimeDatabase db;
+    const QString mime = db.mimeTypeForName(mimeType).name();
+    if (mime.isEmpty()) {
+        return false;
+    }
     return d->m_mimeTypes.contains(mime);
 }
 
@@ -594,7 +599,10 @@ QString KService::menuId() const
 void KService::setMenuId(const QString &_menuId)
 {
     Q_D(KService);
-    d->menuId = _menuId;
+    if (d->menuId != _menuId) {
+        d->menuId = _menuId;
+        d->modified = true;
+    }
 }
 
 QString KService::storageId() const
@@ -740,26 +748,14 @@ QStringList KService::mimeTypes() const
 QStringList KService::schemeHandlers() const
 {
     Q_D(const KService);
-
-    QStringList ret;
-
-    const QLatin1String schemeHandlerPrefix("x-scheme-handler/");
-    for (const auto &mimeName : d->m_mimeTypes) {
-        if (mimeName.startsWith(schemeHandlerPrefix)) {
-            ret.append(mimeName.mid(schemeHandlerPrefix.size()));
-        }
-    }
-
-    return ret;
+    return d->m_schemeHandlers;
 }
 
 QStringList KService::supportedProtocols() const
 {
     Q_D(const KService);
 
-    QStringList ret;
-
-    ret << schemeHandlers();
+    QStringList ret = d->m_schemeHandlers;
 
     const QStringList protocols = property<QStringList>(QStringLiteral("X-KDE-Protocols"));
     for (const QString &protocol : protocols) {
@@ -69,6 +69,7 @@ public:
     QString m_strComment;
     QString m_strLibrary;
     QStringList m_mimeTypes;
+    QStringList m_schemeHandlers; // the x-scheme-handler/* entries of m_mimeTypes, without prefix
     QString m_strDesktopEntryName;
     QMap<QString, QVariant> m_mapProps;
     QStringList m_lstFormFactors;
@@ -77,6 +78,10 @@ public:
     QString m_untranslatedGenericName;
     QString m_untranslatedName;
     QList<KServiceAction> m_actions;
+    // Sorted ids (see KMimeTypeFactory::mimeTypeId) of the MIME types this service has offers for,
+    // including inherited MIME types. Only set for services coming from ksycoca.
+    // Ids rather than offsets, so that the stored service stays the same across incremental updates.
+    QList<qint32> m_mimeTypeIds;
     bool m_bAllowAsDefault : 1;
     bool m_bTerminal : 1;
     bool m_bValid : 1;
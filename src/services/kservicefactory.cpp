@@ -13,6 +13,7 @@
 #include "servicesdebug.h"
 #include <QDir>
 #include <QFile>
+#include <QtEndian>
 
 extern int servicesDebugArea();
 
@@ -21,11 +22,17 @@ KServiceFactory::KServiceFactory(KSycoca *db)
     , m_nameDict(nullptr)
     , m_relNameDict(nullptr)
     , m_menuIdDict(nullptr)
+    , m_storageIdDict(nullptr)
 {
     m_offerListOffset = 0;
     m_nameDictOffset = 0;
     m_relNameDictOffset = 0;
     m_menuIdDictOffset = 0;
+    m_storageIdDictOffset = 0;
+    m_attributeIndexOffset = 0;
+    m_searchIndexOffset = 0;
+    m_nameTableOffset = 0;
+    m_preferredServicesOffset = 0;
     if (!sycoca()->isBuilding()) {
         QDataStream *str = stream();
         if (!str) {
@@ -42,6 +49,16 @@ KServiceFactory::KServiceFactory(KSycoca *db)
         m_offerListOffset = i;
         (*str) >> i;
         m_menuIdDictOffset = i;
+        (*str) >> i;
+        m_storageIdDictOffset = i;
+        (*str) >> i;
+        m_attributeIndexOffset = i;
+        (*str) >> i;
+        m_searchIndexOffset = i;
+        (*str) >> i;
+        m_nameTableOffset = i;
+        (*str) >> i;
+        m_preferredServicesOffset = i;
 
         const qint64 saveOffset = str->device()->pos();
         // Init index tables
@@ -50,6 +67,8 @@ KServiceFactory::KServiceFactory(KSycoca *db)
         m_relNameDict = new KSycocaDict(str, m_relNameDictOffset);
         // Init index tables
         m_menuIdDict = new KSycocaDict(str, m_menuIdDictOffset);
+        // Init index tables
+        m_storageIdDict = new KSycocaDict(str, m_storageIdDictOffset);
         str->device()->seek(saveOffset);
     }
 }
@@ -59,6 +78,7 @@ KServiceFactory::~KServiceFactory()
     delete m_nameDict;
     delete m_relNameDict;
     delete m_menuIdDict;
+    delete m_storageIdDict;
 }
 
 KService::Ptr KServiceFactory::findServiceByName(const QString &_name)
@@ -165,14 +185,31 @@ KService::Ptr KServiceFactory::findServiceByMenuId(const QString &_menuId)
 
 KService::Ptr KServiceFactory::findServiceByStorageId(const QString &_storageId)
 {
-    KService::Ptr service = findServiceByMenuId(_storageId);
-    if (service) {
-        return service;
-    }
+    // Menu ids, desktop paths and desktop names are all in m_storageIdDict, each key
+    // pointing to the service that wins according to the order of precedence.
+    // So the common cases are resolved with a single lookup.
+    // While building, the dict has no stream yet: KBuildServiceFactory's lookups are used instead.
+    const bool useStorageIdDict = m_storageIdDict && !sycoca()->isBuilding();
+    if (useStorageIdDict) {
+        const int offset = m_storageIdDict->find_string(_storageId);
+        if (offset) {
+            KService::Ptr service(createEntry(offset));
+            // Check whether the dictionary was right.
+            if (service
+                && (service->menuId() == _storageId || service->entryPath() == _storageId || service->desktopEntryName() == _storageId)) {
+                return service;
+            }
+        }
+    } else {
+        KService::Ptr service = findServiceByMenuId(_storageId);
+        if (service) {
+            return service;
+        }
 
-    service = findServiceByDesktopPath(_storageId);
-    if (service) {
-        return service;
+        service = findServiceByDesktopPath(_storageId);
+        if (service) {
+            return service;
+        }
     }
 
     if (!QDir::isRelativePath(_storageId) && QFile::exists(_storageId)) {
@@ -190,9 +227,11 @@ KService::Ptr KServiceFactory::findServiceByStorageId(const QString &_storageId)
         tmp.chop(7);
     }
 
-    service = findServiceByDesktopName(tmp);
+    if (useStorageIdDict && tmp == _storageId) {
+        return KService::Ptr(); // already looked up as a desktop name above
+    }
 
-    return service;
+    return findServiceByDesktopName(tmp);
 }
 
 KService *KServiceFactory::createEntry(int offset) const
@@ -229,78 +268,258 @@ QStringList KServiceFactory::resourceDirs()
     return KSycocaFactory::allDirectories(QStringLiteral("applications"));
 }
 
-QList<KServiceOffer> KServiceFactory::offers(int serviceTypeOffset, int serviceOffersOffset)
+QList<KServiceFactory::OfferRecord> KServiceFactory::offerRecords(int serviceTypeOffset, int serviceOffersOffset)
 {
-    QList<KServiceOffer> list;
+    QList<OfferRecord> records;
 
     // Jump to the offer list
     QDataStream *str = stream();
     str->device()->seek(m_offerListOffset + serviceOffersOffset);
 
     qint32 aServiceTypeOffset;
-    qint32 aServiceOffset;
-    qint32 offerPreference;
-    qint32 mimeTypeInheritanceLevel;
     while (true) {
         (*str) >> aServiceTypeOffset;
-        if (aServiceTypeOffset) {
-            (*str) >> aServiceOffset;
-            (*str) >> offerPreference;
-            (*str) >> mimeTypeInheritanceLevel;
-            if (aServiceTypeOffset == serviceTypeOffset) {
-                // Save stream position !
-                const qint64 savedPos = str->device()->pos();
-                // Create Service
-                KService *serv = createEntry(aServiceOffset);
-                if (serv) {
-                    KService::Ptr servPtr(serv);
-                    list.append(KServiceOffer(servPtr, 1, mimeTypeInheritanceLevel));
-                }
-                // Restore position
-                str->device()->seek(savedPos);
-            } else {
-                break; // too far
+        if (aServiceTypeOffset != serviceTypeOffset) {
+            break; // 0 => end of list, otherwise too far
+        }
+        OfferRecord record;
+        (*str) >> record.serviceOffset;
+        (*str) >> record.preference;
+        (*str) >> record.mimeTypeInheritanceLevel;
+        records.append(record);
+    }
+    return records;
+}
+
+KService::Ptr KServiceFactory::service(const OfferRecord &record) const
+{
+    return serviceAtOffset(record.serviceOffset);
+}
+
+KService::Ptr KServiceFactory::serviceAtOffset(int serviceOffset) const
+{
+    return KService::Ptr(createEntry(serviceOffset));
+}
+
+int KServiceFactory::preferredServiceOffset(int mimeTypeId)
+{
+    QDataStream *str = stream();
+    if (!str || !m_preferredServicesOffset || mimeTypeId < 0) {
+        return 0;
+    }
+    // A QList<qint32>, indexed by MIME type id: the count, then the offsets
+    str->device()->seek(m_preferredServicesOffset);
+    quint32 count;
+    (*str) >> count;
+    if (quint32(mimeTypeId) >= count) {
+        return 0;
+    }
+    str->device()->seek(m_preferredServicesOffset + qint64(sizeof(quint32)) + mimeTypeId * qint64(sizeof(qint32)));
+    qint32 serviceOffset;
+    (*str) >> serviceOffset;
+    return serviceOffset;
+}
+
+const KServiceFactory::AttributeIndex &KServiceFactory::attributeIndex()
+{
+    if (!m_attributeIndex) {
+        m_attributeIndex = std::make_unique<AttributeIndex>();
+        QDataStream *str = stream();
+        if (str && m_attributeIndexOffset) {
+            str->device()->seek(m_attributeIndexOffset);
+            AttributeIndex &index = *m_attributeIndex;
+            (*str) >> index.serviceOffsets >> index.noDisplay >> index.terminal;
+            index.categoryTableOffset = str->device()->pos();
+            qint32 keyCount = 0;
+            qint32 keyUnits = 0;
+            qint32 rowCount = 0;
+            (*str) >> keyCount >> keyUnits >> rowCount;
+            index.propertyTableOffset =
+                index.categoryTableOffset + s_keyTableHeaderSize + keyCount * s_keyTableRecordSize + 2 * qint64(keyUnits) + rowCount * qint64(sizeof(qint32));
+
+            const qsizetype serviceCount = index.serviceOffsets.size();
+            if (str->status() != QDataStream::Ok || index.noDisplay.size() != serviceCount || index.terminal.size() != serviceCount || keyCount < 0
+                || keyUnits < 0 || rowCount < 0) {
+                qCWarning(SERVICES) << "KServiceFactory: corrupt attribute index in KSycoca database!";
+                KSycoca::flagError();
+                *m_attributeIndex = AttributeIndex();
             }
+        }
+    }
+    return *m_attributeIndex;
+}
+
+QString KServiceFactory::storedKey(qint64 tableOffset, qint32 keyCount, qint32 record)
+{
+    QDataStream *str = stream();
+    str->device()->seek(tableOffset + s_keyTableHeaderSize + record * s_keyTableRecordSize);
+    qint32 keyOffset;
+    qint32 keyLength;
+    (*str) >> keyOffset >> keyLength;
+    if (str->status() != QDataStream::Ok || keyLength < 0) {
+        return QString();
+    }
+    str->device()->seek(tableOffset + s_keyTableHeaderSize + keyCount * s_keyTableRecordSize + 2 * qint64(keyOffset));
+    const QByteArray stored = str->device()->read(2 * qint64(keyLength));
+    QString key(stored.size() / 2, Qt::Uninitialized);
+    qFromBigEndian<quint16>(stored.constData(), key.size(), key.data());
+    return key;
+}
+
+QList<qint32> KServiceFactory::keyRows(qint64 tableOffset, const QString &key)
+{
+    QDataStream *str = stream();
+    if (!str || !tableOffset) {
+        return {};
+    }
+    str->device()->seek(tableOffset);
+    qint32 keyCount;
+    qint32 keyUnits;
+    qint32 rowCount;
+    (*str) >> keyCount >> keyUnits >> rowCount;
+    if (str->status() != QDataStream::Ok) {
+        return {};
+    }
+    // Binary search in the records, sorted by key
+    qint32 low = 0;
+    qint32 high = keyCount;
+    while (low < high) {
+        const qint32 middle = low + (high - low) / 2;
+        const int cmp = storedKey(tableOffset, keyCount, middle).compare(key);
+        if (cmp < 0) {
+            low = middle + 1;
+        } else if (cmp > 0) {
+            high = middle;
         } else {
-            break; // 0 => end of list
+            str->device()->seek(tableOffset + s_keyTableHeaderSize + middle * s_keyTableRecordSize + 2 * sizeof(qint32));
+            qint32 rowsOffset;
+            qint32 count;
+            (*str) >> rowsOffset >> count;
+            str->device()->seek(tableOffset + s_keyTableHeaderSize + keyCount * s_keyTableRecordSize + 2 * qint64(keyUnits)
+                                + rowsOffset * qint64(sizeof(qint32)));
+            QList<qint32> rows;
+            rows.reserve(count);
+            for (qint32 i = 0; i < count && str->status() == QDataStream::Ok; ++i) {
+                qint32 row;
+                (*str) >> row;
+                rows.append(row);
+            }
+            return rows;
         }
     }
-    return list;
+    return {};
 }
 
-KService::List KServiceFactory::serviceOffers(int serviceTypeOffset, int serviceOffersOffset)
+QList<qint32> KServiceFactory::categoryRows(const QString &category)
 {
-    KService::List list;
+    return keyRows(attributeIndex().categoryTableOffset, category);
+}
 
-    // Jump to the offer list
+QList<qint32> KServiceFactory::propertyRows(const QString &key)
+{
+    return keyRows(attributeIndex().propertyTableOffset, key);
+}
+
+QStringList KServiceFactory::allCategories()
+{
+    const qint64 tableOffset = attributeIndex().categoryTableOffset;
     QDataStream *str = stream();
-    str->device()->seek(m_offerListOffset + serviceOffersOffset);
+    if (!str || !tableOffset) {
+        return {};
+    }
+    str->device()->seek(tableOffset);
+    qint32 keyCount;
+    (*str) >> keyCount;
+    QStringList categories;
+    for (qint32 record = 0; record < keyCount && str->status() == QDataStream::Ok; ++record) {
+        categories.append(storedKey(tableOffset, keyCount, record));
+    }
+    return categories;
+}
 
-    qint32 aServiceTypeOffset;
-    qint32 aServiceOffset;
-    qint32 offerPreference;
-    qint32 mimeTypeInheritanceLevel;
-    while (true) {
-        (*str) >> aServiceTypeOffset;
-        if (aServiceTypeOffset) {
-            (*str) >> aServiceOffset;
-            (*str) >> offerPreference; // unused (remove once KMimeTypeTrader/KServiceTypeTrader are gone)
-            (*str) >> mimeTypeInheritanceLevel; // unused (remove once KMimeTypeTrader/KServiceTypeTrader are gone)
-            if (aServiceTypeOffset == serviceTypeOffset) {
-                // Save stream position !
-                const qint64 savedPos = str->device()->pos();
-                // Create service
-                KService *serv = createEntry(aServiceOffset);
-                if (serv) {
-                    list.append(KService::Ptr(serv));
-                }
-                // Restore position
-                str->device()->seek(savedPos);
-            } else {
-                break; // too far
+const KSubsequenceMatcher::NameTable &KServiceFactory::nameTable()
+{
+    if (!m_nameTable) {
+        m_nameTable = std::make_unique<KSubsequenceMatcher::NameTable>();
+        QDataStream *str = stream();
+        if (str && m_nameTableOffset) {
+            str->device()->seek(m_nameTableOffset);
+            KSubsequenceMatcher::NameTable &table = *m_nameTable;
+            (*str) >> table.names >> table.starts >> table.characterMasks;
+
+            if (str->status() != QDataStream::Ok || !table.isValid()) {
+                qCWarning(SERVICES) << "KServiceFactory: corrupt name table in KSycoca database!";
+                KSycoca::flagError();
+                *m_nameTable = KSubsequenceMatcher::NameTable();
             }
+        }
+    }
+    return *m_nameTable;
+}
+
+QList<quint32> KServiceFactory::searchPostings(quint64 trigram)
+{
+    QDataStream *str = stream();
+    if (!str || !m_searchIndexOffset) {
+        return {};
+    }
+    str->device()->seek(m_searchIndexOffset);
+    qint32 trigramCount;
+    (*str) >> trigramCount;
+
+    // Binary search in the directory: (quint64 trigram, qint32 postings offset, qint32 postings count)
+    const qint64 directoryOffset = m_searchIndexOffset + qint64(sizeof(qint32));
+    const qint64 directoryEntrySize = sizeof(quint64) + 2 * sizeof(qint32);
+    const qint64 postingsOffset = directoryOffset + trigramCount * directoryEntrySize;
+    qint32 low = 0;
+    qint32 high = trigramCount;
+    while (low < high) {
+        const qint32 middle = low + (high - low) / 2;
+        str->device()->seek(directoryOffset + middle * directoryEntrySize);
+        quint64 key;
+        (*str) >> key;
+        if (key < trigram) {
+            low = middle + 1;
+        } else if (key > trigram) {
+            high = middle;
         } else {
-            break; // 0 => end of list
+            qint32 offset;
+            qint32 count;
+            (*str) >> offset >> count;
+            str->device()->seek(postingsOffset + offset * qint64(sizeof(quint32)));
+            QList<quint32> postings;
+            postings.reserve(count);
+            for (qint32 i = 0; i < count; ++i) {
+                quint32 posting;
+                (*str) >> posting;
+                postings.append(posting);
+            }
+            return postings;
+        }
+    }
+    return {};
+}
+
+QList<KServiceOffer> KServiceFactory::offers(int serviceTypeOffset, int serviceOffersOffset)
+{
+    QList<KServiceOffer> list;
+    const QList<OfferRecord> records = offerRecords(serviceTypeOffset, serviceOffersOffset);
+    for (const OfferRecord &record : records) {
+        if (KService::Ptr servPtr = service(record)) {
+            list.append(KServiceOffer(servPtr, 1, record.mimeTypeInheritanceLevel));
+        }
+    }
+    return list;
+}
+
+KService::List KServiceFactory::serviceOffers(int serviceTypeOffset, int serviceOffersOffset)
+{
+    KService::List list;
+    const QList<OfferRecord> records = offerRecords(serviceTypeOffset, serviceOffersOffset);
+    list.reserve(records.size());
+    for (const OfferRecord &record : records) {
+        if (KService::Ptr servPtr = service(record)) {
+            list.append(servPtr);
         }
     }
     return list;
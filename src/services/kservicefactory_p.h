@@ -9,11 +9,16 @@
 #ifndef KSERVICEFACTORY_P_H
 #define KSERVICEFACTORY_P_H
 
+#include <QBitArray>
+#include <QCache>
+#include <QMap>
 #include <QStringList>
 
 #include "kserviceoffer.h"
+#include "ksubsequencematcher_p.h"
 #include "ksycocafactory_p.h"
 #include <assert.h>
+#include <memory>
 
 class KSycoca;
 class KSycocaDict;
@@ -66,8 +71,123 @@ public:
      */
     virtual KService::Ptr findServiceByMenuId(const QString &_menuId);
 
+    /**
+     * Find a service by storage id, i.e. by menu id, desktop path, absolute path or desktop name,
+     * in that order of precedence.
+     */
     KService::Ptr findServiceByStorageId(const QString &_storageId);
 
+    /**
+     * A compact offer, as stored in the offer list of a service type.
+     * The service itself is only decoded by calling service().
+     */
+    struct OfferRecord {
+        qint32 serviceOffset;
+        qint32 preference;
+        qint32 mimeTypeInheritanceLevel;
+    };
+
+    /**
+     * @return the offer records for the given service type, sorted by preference.
+     * No service is decoded.
+     * The @p serviceOffersOffset allows to jump to the right entries directly.
+     */
+    QList<OfferRecord> offerRecords(int serviceTypeOffset, int serviceOffersOffset);
+
+    /**
+     * Decodes the service referenced by @p record.
+     * @return the service, or @c nullptr if it couldn't be read
+     */
+    KService::Ptr service(const OfferRecord &record) const;
+
+    /**
+     * Decodes the service stored at @p serviceOffset.
+     * @return the service, or @c nullptr if it couldn't be read
+     */
+    KService::Ptr serviceAtOffset(int serviceOffset) const;
+
+    /**
+     * @return the offset of the preferred service for the MIME type with the id @p mimeTypeId
+     * (see KMimeTypeFactory::mimeTypeId()), i.e. the first of its offers, or 0 if it has no offers.
+     * This is precomputed by kbuildsycoca, so a single value is read from the database.
+     */
+    int preferredServiceOffset(int mimeTypeId);
+
+    /**
+     * Attributes of all services, stored in columns next to the services so that
+     * queries can be evaluated without decoding the services.
+     * Each service is a row; rows are in the same order as allServices().
+     */
+    struct AttributeIndex {
+        QList<qint32> serviceOffsets; // row -> offset of the service
+        QBitArray noDisplay; // the NoDisplay key
+        QBitArray terminal; // the Terminal key
+        qint64 categoryTableOffset = 0; // category -> sorted rows, see keyRows()
+        qint64 propertyTableOffset = 0; // key in the property map -> sorted rows, see keyRows()
+    };
+
+    /**
+     * @return the attribute index, read from the database on first use.
+     * Only the columns are read; the tables of rows by category and by property key are searched in place.
+     */
+    const AttributeIndex &attributeIndex();
+
+    /**
+     * @return the sorted rows of the services listing @p category in their Categories key
+     */
+    QList<qint32> categoryRows(const QString &category);
+
+    /**
+     * @return the sorted rows of the services having the key @p key in their property map
+     */
+    QList<qint32> propertyRows(const QString &key);
+
+    /**
+     * @return all the categories of the services, sorted
+     */
+    QStringList allCategories();
+
+    /**
+     * The size of the fixed part of a table of rows by key: number of keys, of UTF-16 units of the keys, of rows.
+     * Then come the records sorted by key (key offset, key length, rows offset, row count),
+     * the keys in big endian UTF-16, and the rows.
+     */
+    static constexpr qint64 s_keyTableHeaderSize = 3 * sizeof(qint32);
+    static constexpr qint64 s_keyTableRecordSize = 4 * sizeof(qint32);
+
+    /**
+     * The fields of a service covered by the search index
+     */
+    enum SearchField {
+        SearchName = 1,
+        SearchGenericName = 2,
+        SearchKeywords = 4,
+        SearchComment = 8,
+    };
+
+    /**
+     * @return the postings of @p trigram in the search index (see KServiceUtilPrivate::wordTrigrams),
+     * sorted by row. Each posting is (row << 4 | the SearchField flags of the fields containing the trigram),
+     * row being a row of the attribute index.
+     */
+    QList<quint32> searchPostings(quint64 trigram);
+
+    /**
+     * @return the names of all services, for fuzzy matching, read from the database on first use.
+     * Rows are the rows of the attribute index.
+     */
+    const KSubsequenceMatcher::NameTable &nameTable();
+
+    /**
+     * The unfiltered services of the MIME types queried recently, keyed by the MIME type as requested.
+     * Used by KApplicationTrader. Since the factory is deleted when a new database is opened,
+     * the cache never outlives the database it was filled from.
+     */
+    QCache<QString, KService::List> &mimeTypeServicesCache()
+    {
+        return m_mimeTypeServicesCache;
+    }
+
     /**
      * @return the services supporting the given service type
      * The @p serviceOffersOffset allows to jump to the right entries directly.
@@ -114,11 +234,23 @@ protected:
     int m_relNameDictOffset;
     KSycocaDict *m_menuIdDict;
     int m_menuIdDictOffset;
+    KSycocaDict *m_storageIdDict; // menu ids, desktop paths and desktop names, see findServiceByStorageId
+    int m_storageIdDictOffset;
+    int m_attributeIndexOffset;
+    int m_searchIndexOffset;
+    int m_nameTableOffset;
+    int m_preferredServicesOffset;
 
 protected:
     void virtual_hook(int id, void *data) override;
 
 private:
+    QList<qint32> keyRows(qint64 tableOffset, const QString &key);
+    QString storedKey(qint64 tableOffset, qint32 keyCount, qint32 record);
+
+    std::unique_ptr<AttributeIndex> m_attributeIndex;
+    std::unique_ptr<KSubsequenceMatcher::NameTable> m_nameTable;
+    QCache<QString, KService::List> m_mimeTypeServicesCache;
     class KServiceFactoryPrivate *d;
 };
 
@@ -8,7 +8,9 @@
 #ifndef KSERVICEUTIL_P_H
 #define KSERVICEUTIL_P_H
 
+#include <QList>
 #include <QString>
+#include <QStringList>
 
 class KServiceUtilPrivate
 {
@@ -34,6 +36,72 @@ public:
         }
         return name;
     }
+
+    /**
+     * Lowercases @p text and removes diacritics, the way the search index of ksycoca stores text.
+     *
+     * Example: "Éditeur" --> "editeur"
+     */
+    static QString foldForSearch(const QString &text)
+    {
+        const QString decomposed = text.normalized(QString::NormalizationForm_KD);
+        QString folded;
+        folded.reserve(decomposed.size());
+        for (const QChar c : decomposed) {
+            if (c.category() != QChar::Mark_NonSpacing) {
+                folded.append(c.toLower());
+            }
+        }
+        return folded;
+    }
+
+    /**
+     * Splits @p text into words (runs of letters and digits), folded with foldForSearch().
+     *
+     * Example: "Kate - Éditeur" --> ("kate", "editeur")
+     */
+    static QStringList searchWords(const QString &text)
+    {
+        QStringList words;
+        const QString folded = foldForSearch(text);
+        qsizetype start = -1;
+        for (qsizetype i = 0; i <= folded.size(); ++i) {
+            const bool isWordChar = i < folded.size() && folded.at(i).isLetterOrNumber();
+            if (isWordChar && start == -1) {
+                start = i;
+            } else if (!isWordChar && start != -1) {
+                words.append(folded.mid(start, i - start));
+                start = -1;
+            }
+        }
+        return words;
+    }
+
+    /**
+     * Packs three UTF-16 code units into a key of the search index.
+     * A null QChar stands for the start of a word.
+     */
+    static quint64 searchTrigram(QChar c1, QChar c2, QChar c3)
+    {
+        return (quint64(c1.unicode()) << 32) | (quint64(c2.unicode()) << 16) | quint64(c3.unicode());
+    }
+
+    /**
+     * Returns the keys indexed for @p word: the trigrams of the word preceded by two
+     * start-of-word markers, so that words and prefixes shorter than three characters can be found too.
+     *
+     * Example: "kate" --> ("  k", " ka", "kat", "ate"), with ' ' being the start-of-word marker
+     */
+    static QList<quint64> wordTrigrams(const QString &word)
+    {
+        QList<quint64> trigrams;
+        const QString padded = QString(2, QChar()) + word;
+        trigrams.reserve(word.size());
+        for (qsizetype i = 0; i + 2 < padded.size(); ++i) {
+            trigrams.append(searchTrigram(padded.at(i), padded.at(i + 1), padded.at(i + 2)));
+        }
+        return trigrams;
+    }
 };
 
 #endif
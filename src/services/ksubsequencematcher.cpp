@@ -0,0 +1,121 @@
+/*
+    This file is part of the KDE libraries
+    SPDX-FileCopyrightText: 2026 agent <agent@local>
+
+    SPDX-License-Identifier: LGPL-2.0-or-later
+*/
+
+#include "ksubsequencematcher_p.h"
+
+#include <algorithm>
+
+void KSubsequenceMatcher::NameTable::append(const QString &name)
+{
+    const QString lowerName = toLowerPerCharacter(name);
+    if (starts.isEmpty()) {
+        starts.append(0);
+    }
+    names += lowerName;
+    starts.append(names.size());
+    characterMasks.append(characterMask(lowerName));
+}
+
+QString KSubsequenceMatcher::toLowerPerCharacter(QStringView text)
+{
+    QString lower;
+    lower.resize(text.size());
+    QChar *out = lower.data();
+    for (const QChar c : text) {
+        *out++ = c.toLower();
+    }
+    return lower;
+}
+
+quint64 KSubsequenceMatcher::characterMask(QStringView text)
+{
+    quint64 mask = 0;
+    for (const QChar c : text) {
+        mask |= quint64(1) << (c.unicode() & 63);
+    }
+    return mask;
+}
+
+static bool isWordStart(QStringView text, qsizetype pos)
+{
+    return pos == 0 || !text.at(pos - 1).isLetterOrNumber();
+}
+
+int KSubsequenceMatcher::match(QStringView lowerPattern, QStringView lowerText, QList<int> *positions)
+{
+    if (lowerPattern.isEmpty() || lowerPattern.size() > lowerText.size()) {
+        return 0;
+    }
+    if (positions) {
+        positions->clear();
+        positions->reserve(lowerPattern.size());
+    }
+
+    // Greedy leftmost match, like KApplicationTrader::isSubsequence, scored on the way:
+    // matches at the start of the text or of a word and consecutive matches score higher,
+    // gaps between matches score lower.
+    int score = 0;
+    qsizetype previous = -1;
+    for (const QChar c : lowerPattern) {
+        const qsizetype pos = lowerText.indexOf(c, previous + 1);
+        if (pos == -1) {
+            return 0;
+        }
+        score += 1;
+        if (pos == 0) {
+            score += 5;
+        } else if (isWordStart(lowerText, pos)) {
+            score += 3;
+        }
+        if (previous != -1) {
+            if (pos == previous + 1) {
+                score += 4;
+            } else {
+                score -= int(std::min<qsizetype>(pos - previous - 1, 3));
+            }
+        }
+        if (positions) {
+            positions->append(int(pos));
+        }
+        previous = pos;
+    }
+    return std::max(score, 1);
+}
+
+QList<KSubsequenceMatcher::Match> KSubsequenceMatcher::matchAll(const QString &pattern, const NameTable &table, const QBitArray &skippedRows, int limit)
+{
+    QList<Match> matches;
+    if (pattern.isEmpty() || limit == 0) {
+        return matches;
+    }
+    const QString lowerPattern = toLowerPerCharacter(pattern);
+    const quint64 patternMask = characterMask(lowerPattern);
+
+    const int rowCount = table.count();
+    for (int row = 0; row < rowCount; ++row) {
+        // Prefilter: all the characters of the pattern must be in the name
+        if ((table.characterMasks.at(row) & patternMask) != patternMask) {
+            continue;
+        }
+        if (row < skippedRows.size() && skippedRows.testBit(row)) {
+            continue;
+        }
+        QList<int> positions;
+        const int score = match(lowerPattern, table.name(row), &positions);
+        if (score) {
+            matches.append(Match{row, score, positions});
+        }
+    }
+
+    std::stable_sort(matches.begin(), matches.end(), [](const Match &lhs, const Match &rhs) {
+        return lhs.score > rhs.score;
+    });
+    if (limit > 0 && matches.size() > limit) {
+        matches.resize(limit);
+    }
+    return matches;
+}
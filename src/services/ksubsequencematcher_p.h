@@ -0,0 +1,83 @@
+/*
+    This file is part of the KDE libraries
+    SPDX-FileCopyrightText: 2026 agent <agent@local>
+
+    SPDX-License-Identifier: LGPL-2.0-or-later
+*/
+
+#ifndef KSUBSEQUENCEMATCHER_P_H
+#define KSUBSEQUENCEMATCHER_P_H
+
+#include <QBitArray>
+#include <QList>
+#include <QString>
+
+/**
+ * @internal
+ *
+ * Matches a pattern as a case-insensitive subsequence against many names at once.
+ *
+ * The names are stored lowercased in one contiguous buffer, together with a mask of the
+ * characters they contain, so that most names are rejected with a single AND before scanning.
+ * Scanning uses QStringView::indexOf(QChar), which is vectorized by Qt.
+ */
+class KSubsequenceMatcher
+{
+public:
+    /**
+     * A table of names, lowercased character by character (so that positions
+     * in the lowercased name are positions in the original name)
+     */
+    struct NameTable {
+        QString names; // all names, one after the other
+        QList<qint32> starts; // row -> start of the name in names, plus the end of the last name
+        QList<quint64> characterMasks; // row -> characterMask() of the name
+
+        void append(const QString &name);
+        int count() const
+        {
+            return characterMasks.count();
+        }
+        QStringView name(int row) const
+        {
+            return QStringView(names).mid(starts.at(row), starts.at(row + 1) - starts.at(row));
+        }
+        bool isValid() const
+        {
+            return starts.count() == characterMasks.count() + 1 && (starts.isEmpty() || starts.last() == names.size());
+        }
+    };
+
+    struct Match {
+        int row;
+        int score;
+        QList<int> positions;
+    };
+
+    /**
+     * Lowercases @p text with QChar::toLower, character by character,
+     * like KApplicationTrader::isSubsequence does.
+     */
+    static QString toLowerPerCharacter(QStringView text);
+
+    /**
+     * @return a mask with one bit per character (modulo 64) present in @p text
+     */
+    static quint64 characterMask(QStringView text);
+
+    /**
+     * Matches @p lowerPattern against @p lowerText, both lowercased with toLowerPerCharacter().
+     * @return the score of the match (higher is better), or 0 if @p lowerPattern isn't a subsequence of @p lowerText
+     * @param positions if not null, set to the positions of the matched characters in @p lowerText
+     */
+    static int match(QStringView lowerPattern, QStringView lowerText, QList<int> *positions = nullptr);
+
+    /**
+     * @return the rows of @p table matching @p pattern, best match first (then by row)
+     * @param skippedRows rows to ignore, if set
+     * @param limit the maximum number of matches, or -1 for no limit
+     */
+    static QList<Match> matchAll(const QString &pattern, const NameTable &table, const QBitArray &skippedRows = QBitArray(), int limit = -1);
+};
+
+#endif
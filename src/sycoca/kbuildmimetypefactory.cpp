@@ -8,12 +8,15 @@
 #include "kbuildmimetypefactory_p.h"
 #include "ksycoca.h"
 #include "ksycocadict_p.h"
+#include "ksycocaentry_p.h"
 #include "ksycocaresourcelist_p.h"
 
 #include <QDebug>
 #include <QHash>
 #include <QIODevice>
+#include <QMimeDatabase>
 #include <QStandardPaths>
+#include <algorithm>
 #include <assert.h>
 
 KBuildMimeTypeFactory::KBuildMimeTypeFactory(KSycoca *db)
@@ -21,6 +24,51 @@ KBuildMimeTypeFactory::KBuildMimeTypeFactory(KSycoca *db)
 {
     // We want all xml files under xdgdata/mime - but not mime/packages/*.xml
     m_resourceList.emplace_back("xdgdata-mime", QStringLiteral("mime"), QStringLiteral("*.xml"));
+    m_schemeDict = new KSycocaDict();
+    m_namesDict = new KSycocaDict();
+}
+
+namespace
+{
+// The names of a MIME type, looked up in place through the names dict: see KMimeTypeFactory::findNamesEntry()
+class MimeTypeNamesEntryPrivate : public KSycocaEntryPrivate
+{
+public:
+    K_SYCOCATYPE(KST_KMimeTypeNames, KSycocaEntryPrivate)
+    MimeTypeNamesEntryPrivate(const QString &canonicalName, qint32 id, const QStringList &keys, const QStringList &parents)
+        : KSycocaEntryPrivate(canonicalName)
+        , m_id(id)
+        , m_keys(keys)
+        , m_parents(parents)
+    {
+    }
+    QString name() const override
+    {
+        return path;
+    }
+    void save(QDataStream &s) override
+    {
+        KSycocaEntryPrivate::save(s);
+        s << m_id << m_keys << m_parents;
+    }
+
+    qint32 m_id;
+    QStringList m_keys; // the lowercase name and aliases, to check hits of the dict
+    QStringList m_parents;
+};
+
+class MimeTypeNamesEntry : public KSycocaEntry
+{
+public:
+    MimeTypeNamesEntry(const QString &canonicalName, qint32 id, const QStringList &keys, const QStringList &parents)
+        : KSycocaEntry(*new MimeTypeNamesEntryPrivate(canonicalName, id, keys, parents))
+    {
+    }
+    void save(QDataStream &s)
+    {
+        d_ptr->save(s);
+    }
+};
 }
 
 KBuildMimeTypeFactory::~KBuildMimeTypeFactory()
@@ -62,6 +110,9 @@ KSycocaEntry *KBuildMimeTypeFactory::createEntry(const QString &file) const
 void KBuildMimeTypeFactory::saveHeader(QDataStream &str)
 {
     KSycocaFactory::saveHeader(str);
+
+    str << qint32(m_schemeDictOffset);
+    str << qint32(m_namesDictOffset);
 }
 
 void KBuildMimeTypeFactory::save(QDataStream &str)
@@ -70,6 +121,38 @@ void KBuildMimeTypeFactory::save(QDataStream &str)
 
     str << qint32(0);
 
+    // Index the "x-scheme-handler/*" entries by scheme, so that handlers can be
+    // looked up without going through QMimeDatabase first
+    const QLatin1String schemeHandlerPrefix("x-scheme-handler/");
+    for (auto it = m_entryDict->cbegin(), end = m_entryDict->cend(); it != end; ++it) {
+        const QString name = it.value()->name();
+        if (name.startsWith(schemeHandlerPrefix)) {
+            m_schemeDict->add(name.mid(schemeHandlerPrefix.size()), it.value());
+        }
+    }
+    m_schemeDictOffset = str.device()->pos();
+    m_schemeDict->save(str);
+
+    // Resolve aliases and parents now, so that queries don't need QMimeDatabase
+    m_builtNames = mimeGraph().names;
+    QList<QStringList> keys(m_builtNames.canonicalNames.count());
+    for (auto it = m_builtNames.ids.cbegin(), end = m_builtNames.ids.cend(); it != end; ++it) {
+        keys[it.value()].append(it.key());
+    }
+    for (qint32 id = 0; id < m_builtNames.canonicalNames.count(); ++id) {
+        const QString &canonicalName = m_builtNames.canonicalNames.at(id);
+        QStringList &entryKeys = keys[id];
+        entryKeys.sort();
+        auto *entry = new MimeTypeNamesEntry(canonicalName, id, entryKeys, m_builtNames.parents.value(canonicalName));
+        const KSycocaEntry::Ptr entryPtr(entry);
+        entry->save(str);
+        for (const QString &key : std::as_const(entryKeys)) {
+            m_namesDict->add(key, entryPtr);
+        }
+    }
+    m_namesDictOffset = str.device()->pos();
+    m_namesDict->save(str);
+
     const qint64 endOfFactoryData = str.device()->pos();
 
     // Update header (pass #3)
@@ -79,6 +162,86 @@ void KBuildMimeTypeFactory::save(QDataStream &str)
     str.device()->seek(endOfFactoryData);
 }
 
+int KBuildMimeTypeFactory::builtMimeTypeId(const QString &mimeTypeName) const
+{
+    return m_builtNames.ids.value(mimeTypeName.toLower(), -1);
+}
+
+int KBuildMimeTypeFactory::builtMimeTypeCount() const
+{
+    return m_builtNames.canonicalNames.count();
+}
+
+// Sets the ancestors of @p id, after those of its parents. @p state: 0 = not visited, 1 = in progress, 2 = done
+static void collectAncestors(KBuildMimeTypeFactory::MimeGraph &graph, qint32 id, QList<quint8> &state)
+{
+    if (state.at(id) != 0) {
+        return; // done already, or an inheritance cycle
+    }
+    state[id] = 1;
+    QBitArray &ancestors = graph.ancestorIds[id];
+    for (const qint32 parentId : std::as_const(graph.parentIds.at(id))) {
+        collectAncestors(graph, parentId, state);
+        ancestors.setBit(parentId);
+        ancestors |= graph.ancestorIds.at(parentId);
+    }
+    ancestors.clearBit(id); // in case of a cycle
+    state[id] = 2;
+}
+
+const KBuildMimeTypeFactory::MimeGraph &KBuildMimeTypeFactory::mimeGraph()
+{
+    if (m_mimeGraph) {
+        return *m_mimeGraph;
+    }
+    m_mimeGraph = std::make_unique<MimeGraph>();
+    MimeTypeNames &names = m_mimeGraph->names;
+
+    QMimeDatabase db;
+    QList<QMimeType> mimeTypes = db.allMimeTypes();
+    std::sort(mimeTypes.begin(), mimeTypes.end(), [](const QMimeType &lhs, const QMimeType &rhs) {
+        return lhs.name() < rhs.name();
+    });
+    QList<QStringList> allParents;
+    allParents.reserve(mimeTypes.count());
+    for (const QMimeType &mime : std::as_const(mimeTypes)) {
+        names.ids.insert(mime.name().toLower(), names.canonicalNames.count());
+        names.canonicalNames.append(mime.name());
+        const QStringList parents = mime.parentMimeTypes();
+        if (!parents.isEmpty()) {
+            names.parents.insert(mime.name(), parents);
+        }
+        allParents.append(parents);
+    }
+    for (qint32 id = 0; id < mimeTypes.count(); ++id) {
+        const QStringList aliases = mimeTypes.at(id).aliases();
+        for (const QString &alias : aliases) {
+            const QString key = alias.toLower();
+            if (!names.ids.contains(key)) { // a real MIME type wins over an alias
+                names.ids.insert(key, id);
+            }
+        }
+    }
+
+    // Parents are sometimes returned as aliases by shared-mime-info and/or Qt, hence resolving them
+    const qint32 count = mimeTypes.count();
+    m_mimeGraph->parentIds.resize(count);
+    m_mimeGraph->ancestorIds.fill(QBitArray(count), count);
+    for (qint32 id = 0; id < count; ++id) {
+        for (const QString &parent : std::as_const(allParents.at(id))) {
+            const qint32 parentId = m_mimeGraph->id(parent);
+            if (parentId != -1 && parentId != id && !m_mimeGraph->parentIds.at(id).contains(parentId)) {
+                m_mimeGraph->parentIds[id].append(parentId);
+            }
+        }
+    }
+    QList<quint8> state(count, 0);
+    for (qint32 id = 0; id < count; ++id) {
+        collectAncestors(*m_mimeGraph, id, state);
+    }
+    return *m_mimeGraph;
+}
+
 KMimeTypeFactory::MimeTypeEntry::Ptr KBuildMimeTypeFactory::createFakeMimeType(const QString &name)
 {
     const QString file = name; // hack
@@ -8,9 +8,12 @@
 #ifndef KBUILD_MIME_TYPE_FACTORY_H
 #define KBUILD_MIME_TYPE_FACTORY_H
 
+#include <QBitArray>
 #include <QStringList>
 #include <kmimetypefactory_p.h>
 
+#include <memory>
+
 /**
  * Mime-type factory for building ksycoca
  * @internal
@@ -52,6 +55,52 @@ public:
      * this function.
      */
     void saveHeader(QDataStream &str) override;
+
+    /**
+     * Returns the id of @p mimeTypeName, like mimeTypeId() will once the database is built.
+     * Only valid after save().
+     */
+    int builtMimeTypeId(const QString &mimeTypeName) const;
+
+    /**
+     * Returns the number of MIME type ids. Only valid after save().
+     */
+    int builtMimeTypeCount() const;
+
+    /**
+     * The MIME types of QMimeDatabase, read once per build, so that the builder
+     * can resolve names and check inheritance without going through QMimeDatabase.
+     */
+    struct MimeGraph {
+        MimeTypeNames names; // as saved, see builtMimeTypeId()
+        QList<QList<qint32>> parentIds; // id -> ids of the direct parents, aliases resolved
+        QList<QBitArray> ancestorIds; // id -> ids of all the direct and indirect parents
+
+        /**
+         * @return the id of the MIME type or alias @p name, -1 if it isn't known
+         */
+        qint32 id(const QString &name) const
+        {
+            return names.ids.value(name.toLower(), -1);
+        }
+
+        /**
+         * @return whether @p id is @p ancestorId or inherits it, like QMimeType::inherits()
+         */
+        bool inherits(qint32 id, qint32 ancestorId) const
+        {
+            return id == ancestorId || ancestorIds.at(id).testBit(ancestorId);
+        }
+    };
+
+    /**
+     * @return the MIME graph, built on first use
+     */
+    const MimeGraph &mimeGraph();
+
+private:
+    MimeTypeNames m_builtNames;
+    std::unique_ptr<MimeGraph> m_mimeGraph;
 };
 
 #endif
@@ -10,6 +10,7 @@
 #include "kbuildservicefactory_p.h"
 #include "kbuildservicegroupfactory_p.h"
 #include "ksycoca.h"
+#include "ksycocabuildprofile_p.h"
 
 #include "ksycocadict_p.h"
 #include "sycocadebug.h"
@@ -17,11 +18,16 @@
 
 #include <QDebug>
 #include <QDir>
-#include <QMimeDatabase>
 
 #include <QStandardPaths>
+#include <QThreadPool>
+#include <QtEndian>
+#include <algorithm>
+#include <functional>
+#include <vector>
 #include <kmimetypefactory_p.h>
 #include <kservice_p.h>
+#include <kserviceutil_p.h>
 
 KBuildServiceFactory::KBuildServiceFactory(KBuildMimeTypeFactory *mimeTypeFactory)
     : KServiceFactory(mimeTypeFactory->sycoca())
@@ -34,6 +40,7 @@ KBuildServiceFactory::KBuildServiceFactory(KBuildMimeTypeFactory *mimeTypeFactor
     m_nameDict = new KSycocaDict();
     m_relNameDict = new KSycocaDict();
     m_menuIdDict = new KSycocaDict();
+    m_storageIdDict = new KSycocaDict();
 }
 
 KBuildServiceFactory::~KBuildServiceFactory()
@@ -92,10 +99,17 @@ void KBuildServiceFactory::saveHeader(QDataStream &str)
     str << qint32(m_relNameDictOffset);
     str << qint32(m_offerListOffset);
     str << qint32(m_menuIdDictOffset);
+    str << qint32(m_storageIdDictOffset);
+    str << qint32(m_attributeIndexOffset);
+    str << qint32(m_searchIndexOffset);
+    str << qint32(m_nameTableOffset);
+    str << qint32(m_preferredServicesOffset);
 }
 
 void KBuildServiceFactory::save(QDataStream &str)
 {
+    saveMimeTypeMemberships();
+
     KSycocaFactory::save(str);
 
     m_nameDictOffset = str.device()->pos();
@@ -109,6 +123,14 @@ void KBuildServiceFactory::save(QDataStream &str)
     m_menuIdDictOffset = str.device()->pos();
     m_menuIdDict->save(str);
 
+    m_storageIdDictOffset = str.device()->pos();
+    m_storageIdDict->save(str);
+
+    const KService::List services = servicesInSavedOrder();
+    saveAttributeIndex(str, services);
+    saveSearchIndex(str, services);
+    saveNameTable(str, services);
+
     qint64 endOfFactoryData = str.device()->pos();
 
     // Update header (pass #3)
@@ -122,41 +144,161 @@ void KBuildServiceFactory::collectInheritedServices()
 {
     // For each MIME type, go up the parent MIME type chains and collect offers.
     // For "removed associations" to work, we can't just grab everything from all parents.
-    // We need to process parents before children, hence the recursive call in
-    // collectInheritedServices(mime) and the QSet to process a given parent only once.
-    QSet<QString> visitedMimes;
-    const auto lst = m_mimeTypeFactory->allMimeTypes();
-    for (const QString &mimeType : lst) {
-        collectInheritedServices(mimeType, visitedMimes);
+    // We need to process parents before children: the MIME types are processed by level,
+    // where the parents of a MIME type are all on lower levels, and the MIME types of a level in parallel.
+    const KBuildMimeTypeFactory::MimeGraph &graph = m_mimeTypeFactory->mimeGraph();
+    const qint32 mimeTypeCount = graph.names.canonicalNames.count();
+
+    // The nodes are the MIME types of the graph, by id, followed by the MIME types
+    // of the factory which aren't named like in the graph (aliases), with the parents of their MIME type
+    struct Node {
+        QString name;
+        qint32 mimeTypeId = -1;
+        int level = -1; // -1: not known yet
+        QList<KServiceOffer> offers;
+        std::vector<int> serviceIds; // the services of the offers, as numbered below
+        std::vector<int> removedServiceIds; // sorted
+        bool changed = false;
+    };
+    std::vector<Node> nodes(mimeTypeCount);
+    QBitArray processed(mimeTypeCount); // the MIME types of the factory and all their ancestors
+    const QStringList allMimeTypes = m_mimeTypeFactory->allMimeTypes();
+    for (const QString &mimeTypeName : allMimeTypes) {
+        const qint32 mimeTypeId = graph.id(mimeTypeName);
+        if (mimeTypeId == -1) {
+            continue; // no parents
+        }
+        if (graph.names.canonicalNames.at(mimeTypeId) == mimeTypeName) {
+            processed.setBit(mimeTypeId);
+        } else {
+            Node node;
+            node.name = mimeTypeName;
+            node.mimeTypeId = mimeTypeId;
+            nodes.push_back(std::move(node));
+        }
+        processed |= graph.ancestorIds.at(mimeTypeId);
+    }
+    for (qint32 id = 0; id < mimeTypeCount; ++id) {
+        if (processed.testBit(id)) {
+            nodes[id].name = graph.names.canonicalNames.at(id);
+            nodes[id].mimeTypeId = id;
+        }
     }
-}
 
-void KBuildServiceFactory::collectInheritedServices(const QString &mimeTypeName, QSet<QString> &visitedMimes)
-{
-    if (visitedMimes.contains(mimeTypeName)) {
-        return;
+    // Levels, the services as integers, and the offers so far
+    std::function<int(qint32)> levelOf;
+    auto levelAbove = [&](qint32 mimeTypeId) {
+        int level = 0;
+        for (const qint32 parentId : graph.parentIds.at(mimeTypeId)) {
+            level = std::max(level, levelOf(parentId) + 1);
+        }
+        return level;
+    };
+    levelOf = [&](qint32 mimeTypeId) {
+        Node &node = nodes[mimeTypeId];
+        if (node.level == -1) {
+            node.level = 0; // also breaks inheritance cycles
+            node.level = levelAbove(mimeTypeId);
+        }
+        return node.level;
+    };
+    QHash<const KService *, int> serviceIds;
+    auto serviceId = [&serviceIds](const KService::Ptr &service) {
+        auto it = serviceIds.constFind(service.data());
+        if (it != serviceIds.cend()) {
+            return it.value();
+        }
+        const int id = serviceIds.size();
+        serviceIds.insert(service.data(), id);
+        return id;
+    };
+    std::vector<std::vector<size_t>> levels;
+    const auto &offerHash = m_offerHash.serviceTypeData();
+    for (size_t i = 0; i < nodes.size(); ++i) {
+        Node &node = nodes[i];
+        if (node.mimeTypeId == -1) {
+            continue;
+        }
+        const int level = i < size_t(mimeTypeCount) ? levelOf(node.mimeTypeId) : levelAbove(node.mimeTypeId);
+        if (size_t(level) >= levels.size()) {
+            levels.resize(level + 1);
+        }
+        levels[level].push_back(i);
+
+        auto it = offerHash.constFind(node.name);
+        if (it == offerHash.cend()) {
+            continue;
+        }
+        node.offers = it->offers;
+        for (const KServiceOffer &offer : std::as_const(node.offers)) {
+            node.serviceIds.push_back(serviceId(offer.service()));
+        }
+        for (const KService::Ptr &service : it->removedOffers) {
+            node.removedServiceIds.push_back(serviceId(service));
+        }
+        std::sort(node.removedServiceIds.begin(), node.removedServiceIds.end());
     }
-    visitedMimes.insert(mimeTypeName);
-
-    QMimeDatabase db;
-    const QMimeType qmime = db.mimeTypeForName(mimeTypeName);
-    const auto lst = qmime.parentMimeTypes();
-    for (QString parentMimeType : lst) {
-        // Workaround issue in shared-mime-info and/or Qt, which sometimes return an alias as parent
-        parentMimeType = db.mimeTypeForName(parentMimeType).name();
-
-        collectInheritedServices(parentMimeType, visitedMimes);
-
-        const QList<KServiceOffer> &offers = m_offerHash.offersFor(parentMimeType);
-        for (const auto &serviceOffer : offers) {
-            if (!m_offerHash.hasRemovedOffer(mimeTypeName, serviceOffer.service())) {
-                KServiceOffer offer(serviceOffer);
-                offer.setMimeTypeInheritanceLevel(offer.mimeTypeInheritanceLevel() + 1);
-                // qCDebug(SYCOCA) << "INHERITANCE: Adding service" << (*itserv).service()->entryPath() << "to" << mimeTypeName << "mimeTypeInheritanceLevel="
-                // << mimeTypeInheritanceLevel;
-                m_offerHash.addServiceOffer(mimeTypeName, offer);
+    const int serviceCount = serviceIds.size();
+
+    // Adds the offers of the parents of the node, like KOfferHash::addServiceOffer
+    // pos: the index of each service in the offers of the node, -1 for none
+    auto inheritOffers = [&](Node &node, std::vector<int> &pos) {
+        for (size_t k = 0; k < node.serviceIds.size(); ++k) {
+            pos[node.serviceIds[k]] = int(k);
+        }
+        for (const qint32 parentId : graph.parentIds.at(node.mimeTypeId)) {
+            const Node &parent = nodes[parentId];
+            for (size_t k = 0; k < parent.serviceIds.size(); ++k) {
+                const int serviceId = parent.serviceIds[k];
+                if (std::binary_search(node.removedServiceIds.cbegin(), node.removedServiceIds.cend(), serviceId)) {
+                    continue;
+                }
+                const KServiceOffer &parentOffer = parent.offers.at(k);
+                if (pos[serviceId] == -1) {
+                    KServiceOffer offer(parentOffer);
+                    offer.setMimeTypeInheritanceLevel(offer.mimeTypeInheritanceLevel() + 1);
+                    pos[serviceId] = int(node.offers.size());
+                    node.offers.append(offer);
+                    node.serviceIds.push_back(serviceId);
+                    node.changed = true;
+                } else {
+                    KServiceOffer &offer = node.offers[pos[serviceId]];
+                    if (parentOffer.preference() > offer.preference()) {
+                        offer.setPreference(parentOffer.preference());
+                        node.changed = true;
+                    }
+                }
             }
         }
+        for (const int serviceId : node.serviceIds) {
+            pos[serviceId] = -1;
+        }
+    };
+
+    // The parents are on lower levels, finished, and each node is only written by one thread
+    QThreadPool pool;
+    const qsizetype threadCount = std::max(1, pool.maxThreadCount());
+    for (size_t level = 1; level < levels.size(); ++level) {
+        const std::vector<size_t> &levelNodes = levels[level];
+        const qsizetype nodeCount = levelNodes.size();
+        const qsizetype chunkCount = std::min(nodeCount, threadCount * 4);
+        for (qsizetype chunk = 0; chunk < chunkCount; ++chunk) {
+            const qsizetype begin = nodeCount * chunk / chunkCount;
+            const qsizetype end = nodeCount * (chunk + 1) / chunkCount;
+            pool.start([&, begin, end]() {
+                std::vector<int> pos(serviceCount, -1);
+                for (qsizetype i = begin; i < end; ++i) {
+                    inheritOffers(nodes[levelNodes[i]], pos);
+                }
+            });
+        }
+        pool.waitForDone();
+    }
+
+    for (const Node &node : nodes) {
+        if (node.changed) {
+            m_offerHash.setOffers(node.name, node.offers);
+        }
     }
 }
 
@@ -204,32 +346,50 @@ void KBuildServiceFactory::postProcessServices()
             m_menuIdMemoryHash.insert(menuId, service); // for KMimeAssociations
         }
     }
+
+    // The combined index used by KServiceFactory::findServiceByStorageId.
+    // Keys are added in the order of precedence of the lookups, so that when
+    // several services could match a key, the one that would be found first wins.
+    auto addStorageIds = [this](const QHash<QString, KService::Ptr> &hash) {
+        for (auto it = hash.cbegin(), end = hash.cend(); it != end; ++it) {
+            if (!m_storageIdMemoryHash.contains(it.key())) {
+                m_storageIdMemoryHash.insert(it.key(), it.value()); // for KMimeAssociations
+                m_storageIdDict->add(it.key(), KSycocaEntry::Ptr(it.value().data()));
+            }
+        }
+    };
+    addStorageIds(m_menuIdMemoryHash);
+    addStorageIds(m_relNameMemoryHash);
+    addStorageIds(m_nameMemoryHash);
+
     populateServiceTypes();
 }
 
 void KBuildServiceFactory::populateServiceTypes()
 {
-    QMimeDatabase db;
+    const KBuildMimeTypeFactory::MimeGraph &graph = m_mimeTypeFactory->mimeGraph();
+    QList<qint32> mimeTypeIds;
     // For every service...
     for (auto servIt = m_entryDict->cbegin(), endIt = m_entryDict->cend(); servIt != endIt; ++servIt) {
         KService::Ptr service(static_cast<KService *>(servIt.value().data()));
-        const bool hidden = !service->showInCurrentDesktop();
+        if (!service->showInCurrentDesktop()) {
+            continue; // hidden
+        }
 
         const auto mimeTypes = service->d_func()->m_mimeTypes;
 
+        // Resolve each MIME type once; -1 for those unknown to QMimeDatabase
+        mimeTypeIds.clear();
+        for (const QString &mimeName : mimeTypes) {
+            mimeTypeIds.append(graph.id(mimeName));
+        }
+
         // Add this service to all its MIME types
-        // Don't cache count(), it can change during iteration! (we can't use an iterator-based loop
-        // here the container could get reallocated which would invalidate iterators)
         for (int i = 0; i < mimeTypes.count(); ++i) {
             const QString &mimeName = mimeTypes.at(i);
-
-            if (hidden) {
-                continue;
-            }
-
             KServiceOffer offer(service, 1 /* preference; always 1 here, may be higher based on KMimeAssociations */, 0);
-            QMimeType mime = db.mimeTypeForName(mimeName);
-            if (!mime.isValid()) {
+            const qint32 mimeTypeId = mimeTypeIds.at(i);
+            if (mimeTypeId == -1) {
                 if (mimeName.startsWith(QLatin1String("x-scheme-handler/"))) {
                     // Create those on demand
                     m_mimeTypeFactory->createFakeMimeType(mimeName);
@@ -241,34 +401,33 @@ void KBuildServiceFactory::populateServiceTypes()
                     continue;
                 }
             } else {
-                bool shouldAdd = true;
-                const auto lst = service->mimeTypes();
-
-                for (const QString &otherType : lst) {
-                    // Skip derived types if the base class is listed (#321706)
-                    if (mimeName != otherType && mime.inherits(otherType)) {
-                        // But don't skip aliases (they got resolved into mime.name() already, but don't let two aliases cancel out)
-                        if (db.mimeTypeForName(otherType).name() != mime.name()) {
-                            // qCDebug(SYCOCA) << "Skipping" << mime.name() << "because of" << otherType << "(canonical" << db.mimeTypeForName(otherType) <<
-                            // ") while parsing" << service->entryPath();
-                            shouldAdd = false;
-                        }
-                    }
-                }
+                // Skip derived types if the base class is listed (#321706)
+                // But don't skip aliases (they got resolved to the same id already, but don't let two aliases cancel out)
+                const bool shouldAdd = std::none_of(mimeTypeIds.cbegin(), mimeTypeIds.cend(), [&](qint32 otherId) {
+                    return otherId != -1 && otherId != mimeTypeId && graph.inherits(mimeTypeId, otherId);
+                });
                 if (shouldAdd) {
-                    // qCDebug(SYCOCA) << "Adding service" << service->entryPath() << "to" << mime.name();
-                    m_offerHash.addServiceOffer(mime.name(), offer); // mime.name() so that we resolve aliases
+                    // qCDebug(SYCOCA) << "Adding service" << service->entryPath() << "to" << graph.names.canonicalNames.at(mimeTypeId);
+                    // the canonical name, so that we resolve aliases
+                    m_offerHash.addServiceOffer(graph.names.canonicalNames.at(mimeTypeId), offer);
                 }
             }
         }
     }
 
     // Read user preferences (added/removed associations) and add/remove serviceoffers to m_offerHash
-    KMimeAssociations mimeAssociations(m_offerHash, this);
-    mimeAssociations.parseAllMimeAppsList();
+    {
+        KSycocaBuildProfile::Phase phase("mimeapps");
+        KMimeAssociations mimeAssociations(m_offerHash, this);
+        mimeAssociations.setServicesByStorageId(&m_storageIdMemoryHash);
+        mimeAssociations.parseAllMimeAppsList();
+    }
 
     // Now for each MIME type, collect services from parent MIME types
-    collectInheritedServices();
+    {
+        KSycocaBuildProfile::Phase phase("inherited-offers");
+        collectInheritedServices();
+    }
 
     // Now collect the offsets into the (future) offer list
     // The loops look very much like the ones in saveOfferList obviously.
@@ -307,6 +466,10 @@ void KBuildServiceFactory::saveOfferList(QDataStream &str)
     m_offerListOffset = str.device()->pos();
     // qCDebug(SYCOCA) << "Saving offer list at offset" << m_offerListOffset;
 
+    // MIME type id -> offset of the first offer, for KApplicationTrader::preferredService
+    QList<qint32> preferredServiceOffsets(m_mimeTypeFactory->builtMimeTypeCount(), 0);
+    const QStringList &canonicalNames = m_mimeTypeFactory->mimeGraph().names.canonicalNames;
+
     const auto &offerHash = m_offerHash.serviceTypeData();
     auto it = offerHash.constBegin();
     const auto end = offerHash.constEnd();
@@ -338,9 +501,194 @@ void KBuildServiceFactory::saveOfferList(QDataStream &str)
             str << qint32(offer.mimeTypeInheritanceLevel());
             // update offerEntrySize in populateServiceTypes if you add/remove something here
         }
+
+        // Aliases share the id of their MIME type, only the offers of the canonical name are its preferred ones
+        const int mimeTypeId = m_mimeTypeFactory->builtMimeTypeId(stName);
+        if (mimeTypeId != -1 && !offers.isEmpty() && canonicalNames.at(mimeTypeId) == stName) {
+            preferredServiceOffsets[mimeTypeId] = offers.first().service()->offset();
+        }
     }
 
     str << qint32(0); // End of list marker (0)
+
+    m_preferredServicesOffset = str.device()->pos();
+    str << preferredServiceOffsets;
+}
+
+void KBuildServiceFactory::saveMimeTypeMemberships()
+{
+    // Store in each service the (sorted) ids of its MIME types, so that KService::hasMimeType
+    // is a binary search instead of a walk through the offer list of the MIME type.
+    QHash<KService *, QList<qint32>> memberships;
+    const auto &offerHash = m_offerHash.serviceTypeData();
+    for (auto it = offerHash.constBegin(), end = offerHash.constEnd(); it != end; ++it) {
+        if (!m_mimeTypeFactory->findMimeTypeEntryByName(it.key())) {
+            continue; // not saved in the offer list either
+        }
+        const int mimeTypeId = m_mimeTypeFactory->builtMimeTypeId(it.key());
+        if (mimeTypeId == -1) {
+            continue;
+        }
+        for (const auto &offer : std::as_const(it.value().offers)) {
+            memberships[offer.service().data()].append(mimeTypeId);
+        }
+    }
+
+    for (auto itserv = m_entryDict->cbegin(), endIt = m_entryDict->cend(); itserv != endIt; ++itserv) {
+        KService *service = static_cast<KService *>(itserv.value().data());
+        QList<qint32> ids = memberships.value(service);
+        std::sort(ids.begin(), ids.end());
+        ids.erase(std::unique(ids.begin(), ids.end()), ids.end());
+        KServicePrivate *d = service->d_func();
+        if (d->m_mimeTypeIds != ids) { // might be a reused entry
+            d->m_mimeTypeIds = ids;
+            d->modified = true;
+        }
+    }
+}
+
+KService::List KBuildServiceFactory::servicesInSavedOrder() const
+{
+    // The order of m_entryDict, in which KSycocaFactory::save wrote the linear index.
+    // That's the order of allEntries(), and of the rows of the indexes below.
+    KService::List services;
+    services.reserve(m_entryDict->size());
+    for (auto itserv = m_entryDict->cbegin(), endIt = m_entryDict->cend(); itserv != endIt; ++itserv) {
+        services.append(KService::Ptr(static_cast<KService *>(itserv.value().data())));
+    }
+    return services;
+}
+
+bool KBuildServiceFactory::isStoredUnchanged(const KSycocaEntry::Ptr &entry) const
+{
+    // Services read from the database we append to, which the build didn't modify
+    return m_reuseStoredEntries && entry->offset() != 0 && !static_cast<KService *>(entry.data())->d_func()->modified;
+}
+
+void KBuildServiceFactory::setReuseStoredEntries(bool reuse)
+{
+    m_reuseStoredEntries = reuse;
+}
+
+// Writes a table of rows by key, searched in place by KServiceFactory::keyRows()
+static void saveKeyRows(QDataStream &str, const QMap<QString, QList<qint32>> &rowsByKey)
+{
+    qint32 keyUnits = 0;
+    qint32 rowCount = 0;
+    for (auto it = rowsByKey.cbegin(), end = rowsByKey.cend(); it != end; ++it) {
+        keyUnits += it.key().size();
+        rowCount += it.value().size();
+    }
+    str << qint32(rowsByKey.size()) << keyUnits << rowCount;
+
+    // QMap sorts the keys like QString::compare, which the lookup uses
+    QByteArray keyData;
+    qint32 rowsOffset = 0;
+    for (auto it = rowsByKey.cbegin(), end = rowsByKey.cend(); it != end; ++it) {
+        const QString &key = it.key();
+        str << qint32(keyData.size() / 2) << qint32(key.size()) << rowsOffset << qint32(it.value().size());
+        const qsizetype pos = keyData.size();
+        keyData.resize(pos + 2 * key.size());
+        qToBigEndian<quint16>(key.utf16(), key.size(), keyData.data() + pos);
+        rowsOffset += it.value().size();
+    }
+    str.writeRawData(keyData.constData(), keyData.size());
+    for (const QList<qint32> &rows : rowsByKey) {
+        for (const qint32 row : rows) {
+            str << row;
+        }
+    }
+}
+
+void KBuildServiceFactory::saveAttributeIndex(QDataStream &str, const KService::List &services)
+{
+    KServiceFactory::AttributeIndex index;
+    QMap<QString, QList<qint32>> categoryRows; // category -> sorted rows
+    QMap<QString, QList<qint32>> propertyRows; // key in the property map -> sorted rows
+    const int rowCount = services.count();
+    index.serviceOffsets.reserve(rowCount);
+    index.noDisplay.resize(rowCount);
+    index.terminal.resize(rowCount);
+    for (int row = 0; row < rowCount; ++row) {
+        const KService::Ptr &service = services.at(row);
+        index.serviceOffsets.append(service->offset());
+        index.noDisplay.setBit(row, service->property<bool>(QStringLiteral("NoDisplay")));
+        index.terminal.setBit(row, service->terminal());
+        const auto categories = service->categories();
+        for (const QString &category : categories) {
+            QList<qint32> &rows = categoryRows[category];
+            if (rows.isEmpty() || rows.last() != row) { // Categories=A;A;
+                rows.append(row);
+            }
+        }
+        const auto &props = service->d_func()->m_mapProps;
+        for (auto it = props.cbegin(), end = props.cend(); it != end; ++it) {
+            propertyRows[it.key()].append(row);
+        }
+    }
+
+    m_attributeIndexOffset = str.device()->pos();
+    str << index.serviceOffsets << index.noDisplay << index.terminal;
+    saveKeyRows(str, categoryRows);
+    saveKeyRows(str, propertyRows);
+}
+
+void KBuildServiceFactory::saveSearchIndex(QDataStream &str, const KService::List &services)
+{
+    // trigram -> sorted postings, each posting being (row << 4 | mask of the fields containing the trigram)
+    QHash<quint64, QList<quint32>> postings;
+    auto indexField = [&postings](const QString &text, qint32 row, quint32 field) {
+        const QStringList words = KServiceUtilPrivate::searchWords(text);
+        for (const QString &word : words) {
+            const QList<quint64> trigrams = KServiceUtilPrivate::wordTrigrams(word);
+            for (const quint64 trigram : trigrams) {
+                QList<quint32> &list = postings[trigram];
+                if (!list.isEmpty() && (list.last() >> 4) == quint32(row)) {
+                    list.last() |= field;
+                } else {
+                    list.append((quint32(row) << 4) | field);
+                }
+            }
+        }
+    };
+
+    for (qint32 row = 0; row < services.count(); ++row) {
+        const KService::Ptr &service = services.at(row);
+        indexField(service->name(), row, KServiceFactory::SearchName);
+        indexField(service->genericName(), row, KServiceFactory::SearchGenericName);
+        indexField(service->keywords().join(QLatin1Char(' ')), row, KServiceFactory::SearchKeywords);
+        indexField(service->comment(), row, KServiceFactory::SearchComment);
+    }
+
+    QList<quint64> trigrams = postings.keys();
+    std::sort(trigrams.begin(), trigrams.end());
+
+    // Fixed-size directory sorted by trigram, for binary search, followed by the postings
+    m_searchIndexOffset = str.device()->pos();
+    str << qint32(trigrams.count());
+    qint32 postingsOffset = 0;
+    for (const quint64 trigram : std::as_const(trigrams)) {
+        const qint32 count = postings.value(trigram).count();
+        str << trigram << postingsOffset << count;
+        postingsOffset += count;
+    }
+    for (const quint64 trigram : std::as_const(trigrams)) {
+        const QList<quint32> list = postings.value(trigram);
+        for (const quint32 posting : list) {
+            str << posting;
+        }
+    }
+}
+
+void KBuildServiceFactory::saveNameTable(QDataStream &str, const KService::List &services)
+{
+    KSubsequenceMatcher::NameTable table;
+    for (const KService::Ptr &service : services) {
+        table.append(service->name());
+    }
+
+    m_nameTableOffset = str.device()->pos();
+    str << table.names << table.starts << table.characterMasks;
 }
 
 void KBuildServiceFactory::addEntry(const KSycocaEntry::Ptr &newEntry)
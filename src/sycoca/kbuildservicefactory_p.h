@@ -69,20 +69,35 @@ public:
 
     void postProcessServices();
 
+    /// Reimplemented from KSycocaFactory
+    bool isStoredUnchanged(const KSycocaEntry::Ptr &entry) const override;
+
+    /**
+     * Whether the services read from the previous database, and not modified since,
+     * are kept where they are. Set when the new database is appended to the previous one.
+     */
+    void setReuseStoredEntries(bool reuse);
+
 private:
     void populateServiceTypes();
     void saveOfferList(QDataStream &str);
+    void saveMimeTypeMemberships();
+    KService::List servicesInSavedOrder() const;
+    void saveAttributeIndex(QDataStream &str, const KService::List &services);
+    void saveSearchIndex(QDataStream &str, const KService::List &services);
+    void saveNameTable(QDataStream &str, const KService::List &services);
     void collectInheritedServices();
-    void collectInheritedServices(const QString &mime, QSet<QString> &visitedMimes);
 
     QHash<QString, KService::Ptr> m_nameMemoryHash; // m_nameDict is not usable while building ksycoca
     QHash<QString, KService::Ptr> m_relNameMemoryHash; // m_relNameDict is not usable while building ksycoca
     QHash<QString, KService::Ptr> m_menuIdMemoryHash; // m_menuIdDict is not usable while building ksycoca
+    QHash<QString, KService::Ptr> m_storageIdMemoryHash; // m_storageIdDict is not usable while building ksycoca
     QSet<KSycocaEntry::Ptr> m_dupeDict;
 
     KOfferHash m_offerHash;
 
     KBuildMimeTypeFactory *m_mimeTypeFactory;
+    bool m_reuseStoredEntries = false;
 };
 
 #endif
@@ -8,8 +8,9 @@
 
 #include "kbuildsycoca_p.h"
 #include "ksycoca_p.h"
+#include "ksycocabuildprofile_p.h"
+#include "ksycocadirectoryscanner_p.h"
 #include "ksycocaresourcelist_p.h"
-#include "ksycocautils_p.h"
 #include "sycocadebug.h"
 #include "vfolder_menu_p.h"
 
@@ -21,11 +22,11 @@
 #include <QDateTime>
 #include <QDebug>
 #include <QDir>
-#include <QDirIterator>
 #include <QEventLoop>
 #include <QFile>
 #include <QLocale>
 #include <QSaveFile>
+#include <QThreadPool>
 #include <QTimer>
 #include <config-ksycoca.h>
 #include <kservice.h>
@@ -36,9 +37,112 @@
 #include <QLockFile>
 #include <QStandardPaths>
 #include <qplatformdefs.h>
+#ifdef Q_OS_WIN
+#include <io.h> // _commit
+#endif
+
+#include <algorithm>
+#include <cstring>
+#include <vector>
 
 static const char *s_cSycocaPath = nullptr;
 
+// Incremental updates are appended to the previous database. Once the file is this many times
+// bigger than when it was last written in full, it's written in full again.
+static const int s_compactionFactor = 2;
+
+// Reads the root at @p rootOffset in @p device, filling @p factoryOffsets with the offset of each factory, by id.
+// @return the offset of the header, 0 if it's not a root
+static qint32 readRoot(QIODevice *device, qint64 rootOffset, QHash<qint32, qint32> &factoryOffsets)
+{
+    QDataStream str(device);
+    str.setVersion(QDataStream::Qt_5_3);
+    device->seek(rootOffset);
+    qint32 version;
+    qint32 aId;
+    qint32 aOffset;
+    str >> version;
+    while (str.status() == QDataStream::Ok) {
+        str >> aId;
+        if (aId == 0) {
+            break;
+        }
+        str >> aOffset;
+        factoryOffsets.insert(aId, aOffset);
+    }
+    qint32 headerOffset;
+    qint32 compactedSize;
+    str >> headerOffset >> compactedSize;
+    return str.status() == QDataStream::Ok ? headerOffset : 0;
+}
+
+// Holds the part of the database from startOffset on, where save() writes when appending to the previous
+// database: the positions are offsets in the file, the bytes before startOffset are only in the file.
+class DatabaseBuffer : public QIODevice
+{
+public:
+    DatabaseBuffer(QByteArray *data, qint64 startOffset)
+        : m_data(data)
+        , m_startOffset(startOffset)
+    {
+    }
+
+    bool isSequential() const override
+    {
+        return false;
+    }
+
+    qint64 size() const override
+    {
+        return m_startOffset + m_data->size();
+    }
+
+    bool seek(qint64 pos) override
+    {
+        return pos >= m_startOffset && QIODevice::seek(pos);
+    }
+
+protected:
+    qint64 readData(char *data, qint64 maxSize) override
+    {
+        const qint64 offset = pos() - m_startOffset;
+        const qint64 size = std::clamp<qint64>(m_data->size() - offset, 0, maxSize);
+        memcpy(data, m_data->constData() + offset, size);
+        return size;
+    }
+
+    qint64 writeData(const char *data, qint64 size) override
+    {
+        const qint64 offset = pos() - m_startOffset;
+        if (offset < 0) {
+            return -1;
+        }
+        if (offset + size > m_data->size()) {
+            m_data->resize(offset + size, '\0');
+        }
+        memcpy(m_data->data() + offset, data, size);
+        return size;
+    }
+
+private:
+    QByteArray *m_data;
+    qint64 m_startOffset;
+};
+
+// Makes sure that what was written to @p file is on disk, like QSaveFile::commit() does
+static bool syncToDisk(QFile *file)
+{
+#if defined(Q_OS_LINUX)
+    return ::fdatasync(file->handle()) == 0;
+#elif defined(Q_OS_UNIX)
+    return ::fsync(file->handle()) == 0;
+#elif defined(Q_OS_WIN)
+    return ::_commit(file->handle()) == 0;
+#else
+    return true;
+#endif
+}
+
 KBuildSycocaInterface::~KBuildSycocaInterface()
 {
 }
@@ -60,15 +164,14 @@ KBuildSycoca::KBuildSycoca()
 KBuildSycoca::~KBuildSycoca()
 {
     // Delete the factories while we exist, so that the virtual isBuilding() still works
-    qDeleteAll(*factories());
-    factories()->clear();
+    clear();
 }
 
 KSycocaEntry::Ptr KBuildSycoca::createEntry(KSycocaFactory *currentFactory, const QString &file)
 {
-    quint32 timeStamp = m_ctimeFactory->dict()->ctime(file, m_resource);
+    quint64 timeStamp = m_ctimeFactory->dict()->ctime(file, m_resource);
     if (!timeStamp) {
-        timeStamp = calcResourceHash(m_resourceSubdir, file);
+        timeStamp = fileStamp(m_resourceSubdir, file);
         if (!timeStamp) { // file disappeared meanwhile
             return {};
         }
@@ -76,7 +179,10 @@ KSycocaEntry::Ptr KBuildSycoca::createEntry(KSycocaFactory *currentFactory, cons
     KSycocaEntry::Ptr entry;
     if (m_allEntries) {
         Q_ASSERT(m_ctimeDict);
-        quint32 oldTimestamp = m_ctimeDict->ctime(file, m_resource);
+        // remove from m_ctimeDict; if m_ctimeDict is not empty
+        // after all files have been processed, it means
+        // some files were removed since last time
+        const quint64 oldTimestamp = m_ctimeDict->take(file, m_resource);
         if (file.contains(QLatin1String("fake"))) {
             qCDebug(SYCOCA) << "m_ctimeDict->ctime(" << file << ") = " << oldTimestamp << "compared with" << timeStamp;
         }
@@ -88,16 +194,14 @@ KSycocaEntry::Ptr KBuildSycoca::createEntry(KSycocaFactory *currentFactory, cons
             } else {
                 entry = m_currentEntryDict->value(file);
             }
-            // remove from m_ctimeDict; if m_ctimeDict is not empty
-            // after all files have been processed, it means
-            // some files were removed since last time
             if (file.contains(QLatin1String("fake"))) {
                 qCDebug(SYCOCA) << "reusing (and removing) old entry for:" << file << "entry=" << entry;
             }
-            m_ctimeDict->remove(file, m_resource);
+            if (entry) {
+                KSycocaBuildProfile::count("entriesReused");
+            }
         } else if (oldTimestamp) {
             m_changed = true;
-            m_ctimeDict->remove(file, m_resource);
             qCDebug(SYCOCA) << "modified:" << file;
         } else {
             m_changed = true;
@@ -106,8 +210,16 @@ KSycocaEntry::Ptr KBuildSycoca::createEntry(KSycocaFactory *currentFactory, cons
     }
     m_ctimeFactory->dict()->addCTime(file, m_resource, timeStamp);
     if (!entry) {
-        // Create a new entry
-        entry = currentFactory->createEntry(file);
+        // Create a new entry, unless prefetchServices() parsed it already
+        auto it = m_prefetchedServices.find(file);
+        if (it != m_prefetchedServices.end() && currentFactory == d->m_serviceFactory) {
+            entry = it.value();
+            m_prefetchedServices.erase(it); // a second request gets its own entry, as before
+        } else {
+            KSycocaBuildProfile::Phase phase("parse");
+            entry = currentFactory->createEntry(file);
+            KSycocaBuildProfile::count("entriesParsed");
+        }
     }
     if (entry && entry->isValid()) {
         return entry;
@@ -124,9 +236,102 @@ KService::Ptr KBuildSycoca::createService(const QString &path)
     return KService::Ptr(static_cast<KService *>(entry.data()));
 }
 
+void KBuildSycoca::prefetchServices()
+{
+    KSycocaBuildProfile::Phase phase("parallel-parse");
+
+    // The same files as VFolderMenu::loadApplications, which asks for them with createService(),
+    // under the canonical path of the directories, like the menu code uses
+    QStringList files;
+    const QStringList dirs = QStandardPaths::locateAll(QStandardPaths::GenericDataLocation, m_resourceSubdir, QStandardPaths::LocateDirectory);
+    for (const QString &dir : dirs) {
+        const QString canonicalDir = QDir(dir).canonicalPath();
+        const QStringList relFiles = m_scanner->relativeFilePaths(canonicalDir);
+        for (const QString &relFile : relFiles) {
+            if (relFile.endsWith(QLatin1String(".desktop"))) {
+                files.append(KSycocaDirectoryScanner::filePath(canonicalDir, relFile));
+            }
+        }
+    }
+    if (m_allEntries) {
+        // Unchanged files will be taken from the previous database, don't parse them.
+        // Decided before going parallel, as the scanner's stat cache is used from this thread only
+        Q_ASSERT(m_ctimeDict);
+        files.removeIf([this](const QString &file) {
+            const quint64 timeStamp = fileStamp(m_resourceSubdir, file);
+            return timeStamp && timeStamp == m_ctimeDict->ctime(file, m_resource);
+        });
+    }
+    if (files.isEmpty()) {
+        return;
+    }
+
+    // Parsing is independent per file; the results go to one slot per file, merged in order below
+    std::vector<KSycocaEntry::Ptr> entries(files.size());
+    const KSycocaFactory *factory = d->m_serviceFactory;
+
+    QThreadPool pool;
+    const qsizetype chunkCount = std::min<qsizetype>(files.size(), std::max(1, pool.maxThreadCount()) * 4);
+    for (qsizetype chunk = 0; chunk < chunkCount; ++chunk) {
+        const qsizetype begin = files.size() * chunk / chunkCount;
+        const qsizetype end = files.size() * (chunk + 1) / chunkCount;
+        pool.start([&, begin, end]() {
+            for (qsizetype i = begin; i < end; ++i) {
+                entries[i] = KSycocaEntry::Ptr(factory->createEntry(files.at(i)));
+            }
+        });
+    }
+    pool.waitForDone();
+    KSycocaBuildProfile::count("entriesParsed", files.size());
+
+    for (qsizetype i = 0; i < files.size(); ++i) {
+        m_prefetchedServices.insert(files.at(i), entries[i]);
+    }
+    qCDebug(SYCOCA) << "Parsed" << m_prefetchedServices.count() << "of" << files.count() << "desktop files in parallel";
+}
+
+KSycocaDirectoryScanner *KBuildSycoca::directoryScanner()
+{
+    Q_ASSERT(m_scanner);
+    return m_scanner.get();
+}
+
+QDomDocument KBuildSycoca::menuDocument(const QString &path)
+{
+    const QFileInfo info(path);
+    const qint64 lastModified = info.lastModified().toMSecsSinceEpoch();
+    auto it = m_menuDocuments.constFind(path);
+    if (it != m_menuDocuments.cend() && it->lastModified == lastModified && it->size == info.size()) {
+        KSycocaBuildProfile::count("menuFilesReused");
+        return it->document.cloneNode(true).toDocument(); // the menu code modifies it
+    }
+
+    QDomDocument doc;
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly)) {
+        qCWarning(SYCOCA) << "Could not open " << path;
+        return doc;
+    }
+    if (file.size() == 0) {
+        return doc;
+    }
+    const auto result = doc.setContent(&file);
+    if (!result) {
+        qCWarning(SYCOCA) << "Parse error in " << path << ", line " << result.errorLine << ", col " << result.errorColumn << ": " << result.errorMessage;
+        return QDomDocument();
+    }
+    if (m_keepBuildState) {
+        m_menuDocuments.insert(path, {lastModified, info.size(), doc.cloneNode(true).toDocument()});
+    }
+    return doc;
+}
+
 // returns false if the database is up to date, true if it needs to be saved
 bool KBuildSycoca::build()
 {
+    // Each directory is read only once during the build
+    m_scanner = std::make_unique<KSycocaDirectoryScanner>();
+
     using KBSEntryDictList = QList<KBSEntryDict *>;
     KBSEntryDictList entryDictList;
     KBSEntryDict *serviceEntryDict = nullptr;
@@ -156,13 +361,11 @@ bool KBuildSycoca::build()
     // Save the mtime of each dir, just before we list them
     // ## should we convert to UTC to avoid surprises when summer time kicks in?
     const auto lstDirs = factoryResourceDirs();
-    for (const QString &dir : lstDirs) {
-        qint64 stamp = 0;
-        KSycocaUtilsPrivate::visitResourceDirectory(dir, [&stamp](const QFileInfo &info) {
-            stamp = qMax(stamp, info.lastModified().toMSecsSinceEpoch());
-            return true;
-        });
-        m_allResourceDirs.insert(dir, stamp);
+    {
+        KSycocaBuildProfile::Phase phase("scan");
+        for (const QString &dir : lstDirs) {
+            m_allResourceDirs.insert(dir, m_scanner->resourceDirectoryStamp(dir));
+        }
     }
 
     const auto lstFiles = factoryExtraFiles();
@@ -192,13 +395,13 @@ bool KBuildSycoca::build()
         QSet<QString> relFiles;
         const QStringList dirs = QStandardPaths::locateAll(QStandardPaths::GenericDataLocation, m_resourceSubdir, QStandardPaths::LocateDirectory);
         qCDebug(SYCOCA) << "Looking for subdir" << m_resourceSubdir << "=>" << dirs;
-        for (const QString &dir : dirs) {
-            QDirIterator it(dir, QDirIterator::Subdirectories);
-            while (it.hasNext()) {
-                const QString filePath = it.next();
-                Q_ASSERT(filePath.startsWith(dir)); // due to the line below...
-                const QString relPath = filePath.mid(dir.length() + 1);
-                relFiles.insert(relPath);
+        {
+            KSycocaBuildProfile::Phase phase("scan");
+            for (const QString &dir : dirs) {
+                const QStringList files = m_scanner->relativeFilePaths(dir);
+                for (const QString &relPath : files) {
+                    relFiles.insert(relPath);
+                }
             }
         }
         // Now find all factories that use this resource....
@@ -236,6 +439,9 @@ bool KBuildSycoca::build()
         m_currentEntryDict = serviceEntryDict;
         m_changed = false;
 
+        prefetchServices();
+
+        KSycocaBuildProfile::Phase phase("menu");
         m_vfolder = new VFolderMenu(d->m_serviceFactory, this);
         if (!m_trackId.isEmpty()) {
             m_vfolder->setTrackId(m_trackId);
@@ -255,15 +461,12 @@ bool KBuildSycoca::build()
                 dir.chop(1); // remove trailing slash, to avoid having ~/.local/share/applications twice
             }
             if (!m_allResourceDirs.contains(dir)) {
-                qint64 stamp = 0;
-                KSycocaUtilsPrivate::visitResourceDirectory(dir, [&stamp](const QFileInfo &info) {
-                    stamp = qMax(stamp, info.lastModified().toMSecsSinceEpoch());
-                    return true;
-                });
-                m_allResourceDirs.insert(dir, stamp);
+                m_allResourceDirs.insert(dir, m_scanner->resourceDirectoryStamp(dir));
             }
         }
 
+        m_prefetchedServices.clear(); // not asked for by the menu code
+
         if (m_menuTest) {
             result = false;
         }
@@ -274,10 +477,96 @@ bool KBuildSycoca::build()
         m_ctimeDict->dump();
     }
 
+    // Lets sandboxed applications check the database without trusting modification times
+    if (m_useFingerprints) {
+        KSycocaBuildProfile::Phase phase("fingerprint");
+        m_sourcesFingerprint = m_scanner->sourcesFingerprint(m_allResourceDirs.keys(), m_extraFiles.keys());
+    }
+
     qDeleteAll(entryDictList);
+    KSycocaBuildProfile::count("directoriesRead", m_scanner->directoriesRead());
+    KSycocaBuildProfile::count("directoryEntriesListed", m_scanner->entriesListed());
+    m_scanner.reset();
     return result;
 }
 
+bool KBuildSycoca::reusePreviousEntries()
+{
+    Q_ASSERT(m_allEntries && m_previousDatabase);
+    // save() appends to the previous database if it has the same factories: these ones, and the KCTimeFactory created below
+    const QHash<qint32, qint32> &previousOffsets = m_previousFactoryOffsets;
+    if (previousOffsets.size() != factories()->size() + 1 || !previousOffsets.contains(KST_CTimeInfo)) {
+        return false;
+    }
+    for (KSycocaFactory *factory : std::as_const(*factories())) {
+        if (!previousOffsets.contains(factory->factoryId())) {
+            return false;
+        }
+    }
+    qCDebug(SYCOCA) << "Only the MIME type associations changed, updating the offers";
+
+    // The MIME type entries hold the position of their offers, they are saved again.
+    // Like in build(), the entries of the scheme handlers are created again if they still have offers.
+    for (const KSycocaEntry::Ptr &entry : std::as_const(m_allEntries->at(0))) {
+        KMimeTypeFactory::MimeTypeEntry *mimeTypeEntry = static_cast<KMimeTypeFactory::MimeTypeEntry *>(entry.data());
+        if (mimeTypeEntry->entryPath() != mimeTypeEntry->name()) {
+            mimeTypeEntry->setServiceOffersOffset(-1);
+            d->m_mimeTypeFactory->addEntry(entry);
+        }
+    }
+    // The services are kept where they are, unless the MIME types they have offers for changed
+    for (const KSycocaEntry::Ptr &entry : std::as_const(m_allEntries->at(2))) {
+        d->m_serviceFactory->addEntry(entry);
+    }
+
+    m_ctimeFactory = new KCTimeFactory(this); // This is a build factory too, don't delete!!
+    for (const qint32 factoryId : {qint32(KST_KServiceGroupFactory), qint32(KST_CTimeInfo)}) {
+        m_keptFactoryOffsets.insert(factoryId, previousOffsets.value(factoryId));
+    }
+
+    m_allResourceDirs = KSycocaPrivate::self()->allResourceDirs;
+    const auto lstFiles = factoryExtraFiles();
+    for (const QString &file : lstFiles) {
+        m_extraFiles.insert(file, QFileInfo(file).lastModified().toMSecsSinceEpoch());
+    }
+    return true;
+}
+
+bool KBuildSycoca::fileStampsUpToDate()
+{
+    // The subdirectory of each resource, as build() and createMenu() computed the stamps with it
+    QHash<QByteArray, QString> resourceSubdirs{{QByteArrayLiteral("apps"), QStringLiteral("applications")}};
+    for (const KSycocaFactory *factory : std::as_const(*factories())) {
+        for (const KSycocaResource &res : factory->resourceList()) {
+            resourceSubdirs.insert(res.resource, res.subdir);
+        }
+    }
+
+    KSycocaBuildProfile::Phase phase("check-stamps");
+    m_scanner = std::make_unique<KSycocaDirectoryScanner>();
+    const bool upToDate = m_ctimeDict->forEachFile([&](const QString &path, const QByteArray &resource, quint64 ctime) {
+        const auto it = resourceSubdirs.constFind(resource);
+        if (it == resourceSubdirs.cend() || fileStamp(it.value(), path) != ctime) {
+            qCDebug(SYCOCA) << "modified:" << path;
+            return false;
+        }
+        return true;
+    });
+    m_scanner.reset();
+    return upToDate;
+}
+
+bool KBuildSycoca::extraFilesUpToDate() const
+{
+    const QMap<QString, qint64> &extraFiles = KSycocaPrivate::self()->extraFiles;
+    for (auto it = extraFiles.cbegin(); it != extraFiles.cend(); ++it) {
+        if (QFileInfo(it.key()).lastModified().toMSecsSinceEpoch() != it.value()) {
+            return false;
+        }
+    }
+    return true;
+}
+
 void KBuildSycoca::createMenu(const QString &caption_, const QString &name_, VFolderMenu::SubMenu *menu)
 {
     QString caption = caption_;
@@ -289,14 +578,14 @@ void KBuildSycoca::createMenu(const QString &caption_, const QString &name_, VFo
         if (directoryFile.isEmpty()) {
             directoryFile = subName + QLatin1String(".directory");
         }
-        quint32 timeStamp = m_ctimeFactory->dict()->ctime(directoryFile, m_resource);
+        quint64 timeStamp = m_ctimeFactory->dict()->ctime(directoryFile, m_resource);
         if (!timeStamp) {
-            timeStamp = calcResourceHash(m_resourceSubdir, directoryFile);
+            timeStamp = fileStamp(m_resourceSubdir, directoryFile);
         }
 
         KServiceGroup::Ptr entry;
         if (m_allEntries) {
-            const quint32 oldTimestamp = m_ctimeDict->ctime(directoryFile, m_resource);
+            const quint64 oldTimestamp = m_ctimeDict->ctime(directoryFile, m_resource);
 
             if (timeStamp && (timeStamp == oldTimestamp)) {
                 KSycocaEntry::Ptr group = m_serviceGroupEntryDict->value(subName);
@@ -347,37 +636,73 @@ bool KBuildSycoca::recreate(bool incremental)
     }
     QString path(fi.absoluteFilePath());
 
-    QLockFile lockFile(path + QLatin1String(".lock"));
-    if (!lockFile.tryLock()) {
-        qCDebug(SYCOCA) << "Waiting for already running" << KBUILDSYCOCA_EXENAME << "to finish.";
-        if (!lockFile.lock()) {
-            qCWarning(SYCOCA) << "Couldn't lock" << path + QLatin1String(".lock");
-            return false;
-        }
-        if (!needsRebuild()) {
-            // qCDebug(SYCOCA) << "Up-to-date, skipping.";
-            return true;
+    // Unless lockDatabase() took it already
+    std::unique_ptr<QLockFile> lockFile = std::move(m_lockFile);
+    if (!lockFile) {
+        lockFile = std::make_unique<QLockFile>(path + QLatin1String(".lock"));
+        if (!lockFile->tryLock()) {
+            qCDebug(SYCOCA) << "Waiting for already running" << KBUILDSYCOCA_EXENAME << "to finish.";
+            if (!lockFile->lock()) {
+                qCWarning(SYCOCA) << "Couldn't lock" << path + QLatin1String(".lock");
+                return false;
+            }
+            if (!needsRebuild()) {
+                // qCDebug(SYCOCA) << "Up-to-date, skipping.";
+                return true;
+            }
         }
     }
 
     QByteArray qSycocaPath = QFile::encodeName(path);
     s_cSycocaPath = qSycocaPath.data();
 
-    m_allEntries = nullptr;
-    m_ctimeDict = nullptr;
+    // The factories and the state of a previous recreate() of this object
+    clear();
+    m_reusedBuildState = false;
+    m_previousDatabase.reset();
+    m_previousSize = 0;
+    m_previousFactoryOffsets.clear();
+    m_compactedSize = 0;
+    m_newRootOffset = 0;
+    m_useFingerprints = useFingerprints();
+    m_sourcesFingerprint = 0;
+    m_associationsOnly = false;
+    m_keptFactoryOffsets.clear();
     if (incremental && checkGlobalHeader()) {
+        KSycocaBuildProfile::Phase phase("load-previous");
         qCDebug(SYCOCA) << "Reusing existing ksycoca";
         KSycoca *oldSycoca = KSycoca::self();
+
+        // The new database will be appended to this one in place, reusing its unchanged services,
+        // unless it wasted too much space already: then it's compacted by writing it in full.
+        const KSycocaHeader header = KSycocaPrivate::self()->readSycocaHeader();
+        if (header.compactedSize > 0) {
+            openPreviousDatabase(path, header);
+        }
+
+        // When only mimeapps.list files changed, e.g. after KApplicationTrader::setPreferredService,
+        // the menus and file timestamps are kept from the previous database, see reusePreviousEntries().
+        // Once the stamp of each file was checked, see fileStampsUpToDate().
+        // Not with fingerprints, where directory modification times aren't trusted.
+        m_associationsOnly = m_previousDatabase && !m_useFingerprints && !m_menuTest && KSycocaPrivate::self()->resourceDirsUpToDate();
+
         m_allEntries = new KSycocaEntryListList;
         m_ctimeDict = new KCTimeDict;
 
-        // Must be in same order as in KBuildSycoca::recreate()!
-        m_allEntries->append(KSycocaPrivate::self()->mimeTypeFactory()->allEntries());
-        m_allEntries->append(KSycocaPrivate::self()->serviceGroupFactory()->allEntries());
-        m_allEntries->append(KSycocaPrivate::self()->serviceFactory()->allEntries());
+        if (m_keptCTimeDict && header.timeStamp == m_keptTimestamp) {
+            // The database is the one this object saved last, its entries are still in memory
+            *m_allEntries = m_keptEntries;
+            *m_ctimeDict = *m_keptCTimeDict;
+            m_reusedBuildState = true;
+        } else {
+            // Must be in same order as in KBuildSycoca::recreate()!
+            m_allEntries->append(KSycocaPrivate::self()->mimeTypeFactory()->allEntries());
+            m_allEntries->append(m_associationsOnly ? KSycocaEntry::List() : KSycocaPrivate::self()->serviceGroupFactory()->allEntries());
+            m_allEntries->append(KSycocaPrivate::self()->serviceFactory()->allEntries());
 
-        KCTimeFactory *ctimeInfo = new KCTimeFactory(oldSycoca);
-        *m_ctimeDict = ctimeInfo->loadDict();
+            KCTimeFactory *ctimeInfo = new KCTimeFactory(oldSycoca);
+            *m_ctimeDict = ctimeInfo->loadDict();
+        }
     }
     s_cSycocaPath = nullptr;
 
@@ -393,9 +718,6 @@ bool KBuildSycoca::recreate(bool incremental)
         return false;
     }
 
-    QDataStream *str = new QDataStream(&database);
-    str->setVersion(QDataStream::Qt_5_3);
-
     m_newTimestamp = QDateTime::currentMSecsSinceEpoch();
     qCDebug(SYCOCA).nospace() << "Recreating ksycoca file (" << path << ", version " << KSycoca::version() << ")";
 
@@ -405,33 +727,77 @@ bool KBuildSycoca::recreate(bool incremental)
     d->m_serviceGroupFactory = m_buildServiceGroupFactory;
     d->m_serviceFactory = new KBuildServiceFactory(buildMimeTypeFactory);
 
-    if (build()) { // Parse dirs
-        save(str); // Save database
-        if (str->status() != QDataStream::Ok) { // Probably unnecessary now in Qt5, since QSaveFile detects write errors
+    bool changed;
+    {
+        KSycocaBuildProfile::Phase phase("build");
+        if (m_associationsOnly && fileStampsUpToDate()) {
+            if (extraFilesUpToDate()) {
+                changed = false; // nothing to do
+            } else if (reusePreviousEntries()) {
+                changed = true;
+            } else {
+                changed = build();
+            }
+        } else {
+            changed = build(); // Parse dirs
+        }
+    }
+    if (changed) {
+        // Saving sets the offsets of the entries, the kept state is only valid again once they are written
+        m_keptCTimeDict.reset();
+
+        // The database is laid out in memory, where filling in offsets afterwards costs nothing,
+        // then written to the file at once. When appending, only what follows the previous database is.
+        QByteArray data;
+        DatabaseBuffer buffer(&data, appendsToPreviousDatabase() ? m_previousSize : 0);
+        buffer.open(QIODevice::WriteOnly);
+        QDataStream *str = new QDataStream(&buffer);
+        str->setVersion(QDataStream::Qt_5_3);
+        {
+            KSycocaBuildProfile::Phase phase("save");
+            save(str); // Save database
+        }
+        const bool saved = str->status() == QDataStream::Ok;
+        if (!saved) {
             database.cancelWriting(); // Error
         }
         delete str;
         str = nullptr;
+        buffer.close();
+        if (m_newRootOffset) {
+            // Only what follows the previous database is written, to that file: readers keep their view of it
+            database.cancelWriting();
+            KSycocaBuildProfile::Phase phase("commit");
+            if (!saved || !appendToPreviousDatabase(data)) {
+                return false;
+            }
+        } else {
+            m_previousDatabase.reset(); // about to be replaced
+            database.write(data); // QSaveFile detects write errors, commit() fails then
 
-        // if we are currently via sudo, preserve the original owner
-        // as $HOME may also be that of another user rather than /root
+            // if we are currently via sudo, preserve the original owner
+            // as $HOME may also be that of another user rather than /root
 #ifdef Q_OS_UNIX
-        if (qEnvironmentVariableIsSet("SUDO_UID")) {
-            const int uid = qEnvironmentVariableIntValue("SUDO_UID");
-            const int gid = qEnvironmentVariableIntValue("SUDO_GID");
-            if (uid && gid) {
-                fchown(database.handle(), uid, gid);
+            if (qEnvironmentVariableIsSet("SUDO_UID")) {
+                const int uid = qEnvironmentVariableIntValue("SUDO_UID");
+                const int gid = qEnvironmentVariableIntValue("SUDO_GID");
+                if (uid && gid) {
+                    fchown(database.handle(), uid, gid);
+                }
             }
-        }
 #endif
 
-        if (!database.commit()) {
-            qCWarning(SYCOCA) << "ERROR writing database" << database.fileName() << database.errorString();
-            return false;
+            KSycocaBuildProfile::count("bytesWritten", data.size());
+            KSycocaBuildProfile::Phase phase("commit");
+            if (!database.commit()) {
+                qCWarning(SYCOCA) << "ERROR writing database" << database.fileName() << database.errorString();
+                return false;
+            }
+        }
+        if (m_keepBuildState) {
+            keepBuildState();
         }
     } else {
-        delete str;
-        str = nullptr;
         database.cancelWriting();
         if (m_menuTest) {
             return true;
@@ -446,38 +812,172 @@ bool KBuildSycoca::recreate(bool incremental)
 #endif
 
     delete m_ctimeDict;
+    m_ctimeDict = nullptr;
     delete m_allEntries;
+    m_allEntries = nullptr;
     delete m_vfolder;
+    m_vfolder = nullptr;
 
     return true;
 }
 
-void KBuildSycoca::save(QDataStream *str)
+void KBuildSycoca::clear()
 {
-    // Write header (#pass 1)
-    str->device()->seek(0);
+    delete m_vfolder;
+    m_vfolder = nullptr;
+    delete m_ctimeDict;
+    m_ctimeDict = nullptr;
+    delete m_allEntries;
+    m_allEntries = nullptr;
+    qDeleteAll(*factories());
+    factories()->clear();
+    d->m_mimeTypeFactory = nullptr;
+    d->m_serviceFactory = nullptr;
+    d->m_serviceGroupFactory = nullptr;
+    m_buildServiceGroupFactory = nullptr;
+    m_ctimeFactory = nullptr;
+    m_allResourceDirs.clear();
+    m_extraFiles.clear();
+    m_tempStorage.clear();
+    m_prefetchedServices.clear();
+}
+
+void KBuildSycoca::setKeepBuildState(bool keep)
+{
+    m_keepBuildState = keep;
+    if (!keep) {
+        m_keptEntries.clear();
+        m_keptCTimeDict.reset();
+        m_keptTimestamp = 0;
+        m_menuDocuments.clear();
+    }
+}
+
+bool KBuildSycoca::lockDatabase()
+{
+    if (!m_lockFile) {
+        auto lockFile = std::make_unique<QLockFile>(KSycoca::absoluteFilePath() + QLatin1String(".lock"));
+        if (!lockFile->tryLock()) {
+            return false;
+        }
+        m_lockFile = std::move(lockFile);
+    }
+    return true;
+}
+
+void KBuildSycoca::keepBuildState()
+{
+    const bool keptFactories = !m_keptFactoryOffsets.isEmpty();
+    if (keptFactories && !m_reusedBuildState) {
+        // The timestamps are only in the database, see reusePreviousEntries()
+        m_keptEntries.clear();
+        return;
+    }
+    // Must be in same order as in KBuildSycoca::recreate()!
+    // The service groups are created again by each build: they hold the services the build added to them.
+    m_keptEntries = {d->m_mimeTypeFactory->entryDict()->values(), KSycocaEntry::List(), d->m_serviceFactory->entryDict()->values()};
+    m_keptCTimeDict = std::make_unique<KCTimeDict>(keptFactories ? *m_ctimeDict : *m_ctimeFactory->dict());
+    m_keptTimestamp = m_newTimestamp;
+}
 
+void KBuildSycoca::writeRoot(QDataStream *str, qint32 headerOffset, qint32 compactedSize)
+{
     (*str) << qint32(KSycoca::version());
-    // KSycocaFactory * servicetypeFactory = 0;
-    // KBuildMimeTypeFactory * mimeTypeFactory = 0;
+    const auto lst = *factories();
+    for (KSycocaFactory *factory : lst) {
+        (*str) << qint32(factory->factoryId());
+        (*str) << qint32(m_keptFactoryOffsets.value(factory->factoryId(), factory->offset())); // not set yet in pass 1, so 0
+    }
+    (*str) << qint32(0); // No more factories.
+    (*str) << headerOffset << compactedSize;
+}
+
+bool KBuildSycoca::openPreviousDatabase(const QString &path, const KSycocaHeader &header)
+{
+    // The unchanged entries are reused from KSycoca::self(), check that it's still what the file contains
+    KSycocaPrivate *previous = KSycocaPrivate::self();
+    const qint64 previousSize = previous->device()->device()->size();
+    const qint64 previousRootOffset = previous->rootOffset();
+    if (previous->m_databasePath != path || previousSize >= s_compactionFactor * qint64(header.compactedSize)) {
+        return false;
+    }
+    auto file = std::make_unique<QFile>(path);
+    if (!file->open(QIODevice::ReadWrite) || file->size() != previousSize || KSycocaPrivate::findRootOffset(file.get()) != previousRootOffset) {
+        qCDebug(SYCOCA) << "The database changed since it was opened, writing it in full";
+        return false;
+    }
+    QHash<qint32, qint32> factoryOffsets;
+    const qint32 headerOffset = readRoot(file.get(), previousRootOffset, factoryOffsets);
+    QDataStream str(file.get());
+    str.setVersion(QDataStream::Qt_5_3);
+    file->seek(headerOffset);
+    KSycocaHeader fileHeader;
+    str >> fileHeader;
+    if (!headerOffset || str.status() != QDataStream::Ok || fileHeader.timeStamp != header.timeStamp) {
+        qCDebug(SYCOCA) << "The database changed since it was opened, writing it in full";
+        return false;
+    }
+
+    m_previousDatabase = std::move(file);
+    m_previousSize = previousSize;
+    m_previousFactoryOffsets = factoryOffsets;
+    m_compactedSize = header.compactedSize;
+    return true;
+}
+
+bool KBuildSycoca::appendToPreviousDatabase(const QByteArray &data)
+{
+    // The root and the trailer come last, once what they point to is on disk: after a crash,
+    // the file ends either with the previous trailer or with a valid new one
+    QFile *file = m_previousDatabase.get();
+    const qint64 dataSize = m_newRootOffset - m_previousSize;
+    const qint64 rootSize = data.size() - dataSize;
+    if (!file->seek(m_previousSize) || file->write(data.constData(), dataSize) != dataSize || !file->flush() || !syncToDisk(file)
+        || file->write(data.constData() + dataSize, rootSize) != rootSize || !file->flush() || !syncToDisk(file)) {
+        qCWarning(SYCOCA) << "ERROR appending to database" << file->fileName() << file->errorString();
+        file->resize(m_previousSize);
+        return false;
+    }
+    qCDebug(SYCOCA) << "Appended" << data.size() << "bytes to the previous database," << m_previousSize << "bytes";
+    KSycocaBuildProfile::count("bytesKept", m_previousSize);
+    KSycocaBuildProfile::count("bytesWritten", data.size());
+    m_previousDatabase.reset();
+    return true;
+}
+
+bool KBuildSycoca::appendsToPreviousDatabase()
+{
+    bool append = m_previousDatabase && m_previousFactoryOffsets.size() == factories()->size();
+    for (const KSycocaFactory *factory : std::as_const(*factories())) {
+        append = append && m_previousFactoryOffsets.contains(factory->factoryId());
+    }
+    return append;
+}
+
+void KBuildSycoca::save(QDataStream *str)
+{
+    // Append to the previous database if it has the same factories. Nothing before its end is written,
+    // readers which mapped it keep a valid view: its unchanged services are kept where they are,
+    // the rest and a new root are written after it.
+    const bool append = appendsToPreviousDatabase();
+    Q_ASSERT(append || m_keptFactoryOffsets.isEmpty());
+    if (append) {
+        str->device()->seek(m_previousSize); // where the DatabaseBuffer starts
+    } else {
+        // Write root (#pass 1)
+        writeRoot(str, 0, 0);
+    }
+
     KBuildServiceFactory *serviceFactory = nullptr;
     auto lst = *factories();
     for (KSycocaFactory *factory : std::as_const(lst)) {
-        qint32 aId;
-        qint32 aOffset;
-        aId = factory->factoryId();
-        // if ( aId == KST_KServiceTypeFactory )
-        //   servicetypeFactory = factory;
-        // else if ( aId == KST_KMimeTypeFactory )
-        //   mimeTypeFactory = static_cast<KBuildMimeTypeFactory *>( factory );
-        if (aId == KST_KServiceFactory) {
+        if (factory->factoryId() == KST_KServiceFactory) {
             serviceFactory = static_cast<KBuildServiceFactory *>(factory);
         }
-        aOffset = factory->offset(); // not set yet, so always 0
-        (*str) << aId;
-        (*str) << aOffset;
     }
-    (*str) << qint32(0); // No more factories.
+
+    // Write header
+    const qint64 headerOffset = str->device()->pos();
     // Write XDG_DATA_DIRS
     (*str) << QStandardPaths::standardLocations(QStandardPaths::GenericDataLocation).join(QString(QLatin1Char(':')));
     (*str) << m_newTimestamp;
@@ -492,10 +992,13 @@ void KBuildSycoca::save(QDataStream *str)
     for (auto it = m_extraFiles.constBegin(); it != m_extraFiles.constEnd(); ++it) {
         (*str) << it.value();
     }
+    (*str) << m_sourcesFingerprint; // 0 without fingerprints
 
     // Calculate per-servicetype/MIME type data
     if (serviceFactory) {
+        KSycocaBuildProfile::Phase phase("post-process");
         serviceFactory->postProcessServices();
+        serviceFactory->setReuseStoredEntries(append);
     }
 
     // Here so that it's the last debug message
@@ -504,6 +1007,9 @@ void KBuildSycoca::save(QDataStream *str)
     // Write factory data....
     lst = *factories();
     for (KSycocaFactory *factory : std::as_const(lst)) {
+        if (m_keptFactoryOffsets.contains(factory->factoryId())) {
+            continue; // still valid in the previous database
+        }
         factory->save(*str);
         if (str->status() != QDataStream::Ok) { // ######## TODO: does this detect write errors, e.g. disk full?
             return; // error
@@ -512,23 +1018,18 @@ void KBuildSycoca::save(QDataStream *str)
 
     qint64 endOfData = str->device()->pos();
 
-    // Write header (#pass 2)
-    str->device()->seek(0);
-
-    (*str) << qint32(KSycoca::version());
-    lst = *factories();
-    for (KSycocaFactory *factory : std::as_const(lst)) {
-        qint32 aId;
-        qint32 aOffset;
-        aId = factory->factoryId();
-        aOffset = factory->offset();
-        (*str) << aId;
-        (*str) << aOffset;
+    // Write root (#pass 2), followed by the trailer saying where it is, see KSycocaPrivate::rootOffset()
+    if (append) {
+        m_newRootOffset = endOfData;
+        writeRoot(str, qint32(headerOffset), m_compactedSize);
+        (*str) << qint32(m_newRootOffset);
+    } else {
+        str->device()->seek(0);
+        writeRoot(str, qint32(headerOffset), qint32(endOfData));
+        str->device()->seek(endOfData);
+        (*str) << qint32(0);
     }
-    (*str) << qint32(0); // No more factories.
-
-    // Jump to end of database
-    str->device()->seek(endOfData);
+    (*str) << KSycocaPrivate::s_rootTrailerMagic;
 }
 
 QStringList KBuildSycoca::factoryResourceDirs()
@@ -555,6 +1056,11 @@ QStringList KBuildSycoca::factoryExtraFiles()
     return files;
 }
 
+QStringList KBuildSycoca::factoryExtraFileCandidates()
+{
+    return KMimeAssociations::mimeAppsFileCandidates();
+}
+
 QStringList KBuildSycoca::existingResourceDirs()
 {
     static QStringList *dirs = nullptr;
@@ -572,13 +1078,23 @@ QStringList KBuildSycoca::existingResourceDirs()
     return *dirs;
 }
 
-static quint32 updateHash(const QString &file, quint32 hash)
+static quint32 updateHash(const QString &file, quint32 hash, KSycocaDirectoryScanner *scanner)
 {
-    QFileInfo fi(file);
-    if (fi.isReadable() && fi.isFile()) {
+    bool isReadableFile;
+    qint64 lastModified;
+    if (scanner) {
+        const KSycocaDirectoryScanner::FileInfo info = scanner->fileInfo(file);
+        isReadableFile = info.isReadable && info.isFile;
+        lastModified = info.lastModified;
+    } else {
+        QFileInfo fi(file);
+        isReadableFile = fi.isReadable() && fi.isFile();
+        lastModified = isReadableFile ? fi.lastModified().toMSecsSinceEpoch() : 0;
+    }
+    if (isReadableFile) {
         // This was using buff.st_ctime (in Waldo's initial commit to kstandarddirs.cpp in 2001), but that looks wrong?
         // Surely we want to catch manual editing, while a chmod doesn't matter much?
-        qint64 timestamp = fi.lastModified().toSecsSinceEpoch();
+        qint64 timestamp = lastModified / 1000;
         // On some systems (i.e. Fedora Kinoite), all files in /usr have a last
         // modified timestamp of 0 (UNIX Epoch). In this case, always assume
         // the file as been changed.
@@ -591,18 +1107,23 @@ static quint32 updateHash(const QString &file, quint32 hash)
     return hash;
 }
 
-quint32 KBuildSycoca::calcResourceHash(const QString &resourceSubDir, const QString &filename)
+quint32 KBuildSycoca::calcResourceHash(const QString &resourceSubDir, const QString &filename, KSycocaDirectoryScanner *scanner)
 {
     quint32 hash = 0;
     if (!QDir::isRelativePath(filename)) {
-        return updateHash(filename, hash);
+        return updateHash(filename, hash, scanner);
     }
     const QString filePath = resourceSubDir + QLatin1Char('/') + filename;
     const QString qrcFilePath = QStringLiteral(":/") + filePath;
-    const QStringList files =
-        QFileInfo::exists(qrcFilePath) ? QStringList{qrcFilePath} : QStandardPaths::locateAll(QStandardPaths::GenericDataLocation, filePath);
-    for (const QString &file : files) {
-        hash = updateHash(file, hash);
+    QStringList files;
+    if (QFileInfo::exists(qrcFilePath)) {
+        files = QStringList{qrcFilePath};
+        scanner = nullptr; // not on disk
+    } else {
+        files = scanner ? scanner->locateAll(filePath) : QStandardPaths::locateAll(QStandardPaths::GenericDataLocation, filePath);
+    }
+    for (const QString &file : std::as_const(files)) {
+        hash = updateHash(file, hash, scanner);
     }
     if (hash == 0 && !filename.endsWith(QLatin1String("update_ksycoca"))
         && !filename.endsWith(QLatin1String(".directory")) // bug? needs investigation from someone who understands the VFolder spec
@@ -618,6 +1139,35 @@ quint32 KBuildSycoca::calcResourceHash(const QString &resourceSubDir, const QStr
     return hash;
 }
 
+bool KBuildSycoca::useFingerprints()
+{
+    return qEnvironmentVariableIntValue("KSYCOCA_FINGERPRINTS") != 0;
+}
+
+quint64 KBuildSycoca::fileStamp(const QString &resourceSubDir, const QString &filename)
+{
+    if (!m_useFingerprints) {
+        return calcResourceHash(resourceSubDir, filename, m_scanner.get());
+    }
+    // Like calcResourceHash, with the contents of the files rather than their modification times
+    QStringList files;
+    if (!QDir::isRelativePath(filename)) {
+        files = QStringList{filename};
+    } else {
+        const QString filePath = resourceSubDir + QLatin1Char('/') + filename;
+        const QString qrcFilePath = QStringLiteral(":/") + filePath;
+        files = QFileInfo::exists(qrcFilePath) ? QStringList{qrcFilePath} : m_scanner->locateAll(filePath);
+    }
+    quint64 stamp = 0;
+    for (const QString &file : std::as_const(files)) {
+        const quint64 fingerprint = m_scanner->contentFingerprint(file);
+        if (fingerprint) {
+            stamp = stamp ? KSycocaDirectoryScanner::combineFingerprints(stamp, fingerprint) : fingerprint;
+        }
+    }
+    return stamp;
+}
+
 bool KBuildSycoca::checkGlobalHeader()
 {
     // Since it's part of the filename, we are 99% sure that the locale and prefixes will match.
@@ -15,8 +15,13 @@
 
 #include "vfolder_menu_p.h"
 
+#include <memory>
+
 class KBuildServiceGroupFactory;
 class QDataStream;
+class QFile;
+class QLockFile;
+struct KSycocaHeader;
 class KCTimeFactory;
 class KCTimeDict;
 
@@ -47,8 +52,27 @@ public:
         m_menuTest = b;
     }
 
+    /**
+     * Keep the entries, the file timestamps and the parsed menu files of each build in memory,
+     * for the next recreate() of this object: the entries aren't read back from the database then,
+     * and the menu files which didn't change aren't parsed again. Used by kbuildsycoca --daemon.
+     */
+    void setKeepBuildState(bool keep);
+
+    /**
+     * Take the lock of recreate() now, if no one else holds it, and keep it until the next recreate()
+     * of this object: applications which notice a change in the meantime wait for that recreate()
+     * instead of building the database themselves. Used by kbuildsycoca --daemon.
+     * @return true if this object holds the lock
+     */
+    bool lockDatabase();
+
     static QStringList factoryResourceDirs();
     static QStringList factoryExtraFiles();
+    /**
+     * @return the paths where factoryExtraFiles() are looked for, including the files which don't exist (yet)
+     */
+    static QStringList factoryExtraFileCandidates();
     static QStringList existingResourceDirs();
 
     /**
@@ -57,7 +81,16 @@ public:
      *
      * When a change is made to the file this number will change.
      */
-    static quint32 calcResourceHash(const QString &subdir, const QString &filename);
+    static quint32 calcResourceHash(const QString &subdir, const QString &filename, KSycocaDirectoryScanner *scanner = nullptr);
+
+    /**
+     * @return true if the files are identified by a fingerprint of their contents rather than by their
+     * modification times, in the database and when comparing with it. Set KSYCOCA_FINGERPRINTS=1 to enable.
+     *
+     * This makes incremental builds exact, and lets sandboxed applications check a database
+     * shipped in an image where all files have the same modification time.
+     */
+    static bool useFingerprints();
 
     /**
      * Compare our current settings (language, prefixes...) with the ones from the existing ksycoca global header.
@@ -83,6 +116,31 @@ private:
      */
     KService::Ptr createService(const QString &path) override;
 
+    /**
+     * Implementation of KBuildSycocaInterface
+     * Only valid during build().
+     */
+    KSycocaDirectoryScanner *directoryScanner() override;
+
+    /**
+     * Implementation of KBuildSycocaInterface
+     */
+    QDomDocument menuDocument(const QString &path) override;
+
+    /**
+     * @return the stamp stored for @p filename in the KCTimeDict: calcResourceHash(), or
+     * a fingerprint of the contents of the files if useFingerprints(); 0 if it doesn't exist.
+     * Only valid during build().
+     */
+    KSERVICE_NO_EXPORT quint64 fileStamp(const QString &subdir, const QString &filename);
+
+    /**
+     * Parse the desktop files of all applications on a thread pool, ahead of the VFolderMenu code.
+     * createEntry() then takes the parsed entries from m_prefetchedServices, in the same
+     * order as it would have parsed them, so the result doesn't change.
+     */
+    KSERVICE_NO_EXPORT void prefetchServices();
+
     /**
      * Convert a VFolderMenu::SubMenu to KServiceGroups.
      */
@@ -94,15 +152,66 @@ private:
     KSERVICE_NO_EXPORT bool build();
 
     /**
-     * Save the ksycoca file
+     * Fill the factories from the previous database instead of build(), when only mimeapps.list files
+     * changed since it was built: the services, menus and file timestamps are still the same.
+     * save() then only computes the offers again; the menus and timestamps are kept where they are.
+     * @return false if the previous database can't be appended to, build() must be used then
+     */
+    KSERVICE_NO_EXPORT bool reusePreviousEntries();
+
+    /**
+     * @return true if the stamp of each file of the previous database, in m_ctimeDict, is still the same.
+     * Checked before reusePreviousEntries(): editing a file in place doesn't change the modification
+     * time of its directory.
+     */
+    KSERVICE_NO_EXPORT bool fileStampsUpToDate();
+
+    /**
+     * @return true if the modification time of each mimeapps.list file is still the one stored in the previous database
+     */
+    KSERVICE_NO_EXPORT bool extraFilesUpToDate() const;
+
+    /**
+     * Save the ksycoca file.
+     * When there is a previous database to append to, the unchanged services are kept
+     * from it, and the new entries, indexes and root are written after it.
      */
     KSERVICE_NO_EXPORT void save(QDataStream *str);
 
     /**
-     * Clear the factories
+     * Write the version and the table of factories,
+     * followed by the offset of the header and the size of the last full write
+     */
+    KSERVICE_NO_EXPORT void writeRoot(QDataStream *str, qint32 headerOffset, qint32 compactedSize);
+
+    /**
+     * Open the database at @p path to append to it, if it's the one KSycoca::self() reads,
+     * whose header is @p header, and it isn't due for compaction.
+     * @return false if the new database must be written in full
+     */
+    KSERVICE_NO_EXPORT bool openPreviousDatabase(const QString &path, const KSycocaHeader &header);
+
+    /**
+     * Write what save() put after the end of the previous database to it, in place.
+     * @p data starts at the end of the previous database.
+     */
+    KSERVICE_NO_EXPORT bool appendToPreviousDatabase(const QByteArray &data);
+
+    /**
+     * @return true if save() appends to m_previousDatabase: it has the same factories
+     */
+    KSERVICE_NO_EXPORT bool appendsToPreviousDatabase();
+
+    /**
+     * Clear the factories, and what the last build left
      */
     KSERVICE_NO_EXPORT void clear();
 
+    /**
+     * Keep the entries and timestamps of the build which was just saved, see setKeepBuildState()
+     */
+    KSERVICE_NO_EXPORT void keepBuildState();
+
     /**
      * @internal
      * @return true if building (i.e. if a KBuildSycoca);
@@ -120,6 +229,7 @@ private:
     QString m_resourceSubdir; // e.g. "mime" (xdgdata subdir)
 
     KSycocaEntry::List m_tempStorage;
+    QHash<QString, KSycocaEntry::Ptr> m_prefetchedServices; // absolute path -> parsed service, null if invalid
     typedef QList<KSycocaEntry::List> KSycocaEntryListList;
     KSycocaEntryListList *m_allEntries; // entries from existing ksycoca
     KBuildServiceGroupFactory *m_buildServiceGroupFactory = nullptr;
@@ -129,6 +239,28 @@ private:
     KBSEntryDict *m_currentEntryDict = nullptr;
     KBSEntryDict *m_serviceGroupEntryDict = nullptr;
     VFolderMenu *m_vfolder = nullptr;
+    std::unique_ptr<KSycocaDirectoryScanner> m_scanner; // during build() and fileStampsUpToDate()
+    std::unique_ptr<QLockFile> m_lockFile; // taken by lockDatabase(), until the next recreate()
+    std::unique_ptr<QFile> m_previousDatabase; // to append to, see save()
+    qint64 m_previousSize = 0; // of m_previousDatabase, as KSycoca::self() reads it
+    QHash<qint32, qint32> m_previousFactoryOffsets; // factory id -> offset, in the newest root of m_previousDatabase
+    qint32 m_compactedSize = 0; // of m_previousDatabase
+    qint64 m_newRootOffset = 0; // set by save() when appending to m_previousDatabase
+    bool m_associationsOnly = false; // see reusePreviousEntries()
+    QHash<qint32, qint32> m_keptFactoryOffsets; // factory id -> offset in m_previousDatabase, for the factories not saved again
+    bool m_keepBuildState = false;
+    bool m_reusedBuildState = false; // m_allEntries and m_ctimeDict come from the kept state
+    KSycocaEntryListList m_keptEntries; // of the last saved build, see setKeepBuildState()
+    std::unique_ptr<KCTimeDict> m_keptCTimeDict; // of the last saved build, in memory
+    qint64 m_keptTimestamp = 0; // of the database written by the last saved build
+    struct MenuDocument {
+        qint64 lastModified;
+        qint64 size;
+        QDomDocument document;
+    };
+    QHash<QString, MenuDocument> m_menuDocuments; // path -> parsed menu file, if m_keepBuildState
+    bool m_useFingerprints = false;
+    quint64 m_sourcesFingerprint = 0; // see KSycocaDirectoryScanner::sourcesFingerprint
     qint64 m_newTimestamp;
 
     bool m_menuTest;
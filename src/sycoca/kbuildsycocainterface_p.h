@@ -10,11 +10,18 @@
 
 #include <kservice.h>
 
+class KSycocaDirectoryScanner;
+class QDomDocument;
+
 class KBuildSycocaInterface
 {
 public:
     virtual ~KBuildSycocaInterface();
     virtual KService::Ptr createService(const QString &path) = 0;
+    // Lists directories for the current build, reading each of them only once
+    virtual KSycocaDirectoryScanner *directoryScanner() = 0;
+    // Parses the menu file @p path, or copies the document parsed by a previous build if the file didn't change
+    virtual QDomDocument menuDocument(const QString &path) = 0;
 };
 
 #endif /* KBUILDSYCOCAINTERFACE_H */
@@ -11,56 +11,261 @@
 #include <ksycocatype.h>
 #include <ksycocautils_p.h>
 
+#include <QIODevice>
+#include <QtEndian>
+
+#include <algorithm>
 #include <assert.h>
 
 // NOTE: the storing of "resource" here is now completely useless (since everything is under GenericDataLocation)
 
-static inline QString key(const QString &path, const QByteArray &resource)
+// A stored record: resource index, offset and length of the path in UTF-16 units, timestamp
+static const qint64 s_recordSize = 3 * sizeof(qint32) + sizeof(quint64);
+
+// Compares the big endian UTF-16 @p stored path of @p length units with @p path, like QString::compare
+static int compareStoredPath(const char *stored, int length, const QString &path)
 {
-    return QString::fromLatin1(resource) + QLatin1Char('|') + path;
+    const int commonLength = std::min<int>(length, path.size());
+    for (int i = 0; i < commonLength; ++i) {
+        const int diff = int(qFromBigEndian<quint16>(stored + 2 * i)) - int(path.at(i).unicode());
+        if (diff != 0) {
+            return diff;
+        }
+    }
+    return length - int(path.size());
 }
 
-void KCTimeDict::addCTime(const QString &path, const QByteArray &resource, quint32 ctime)
+void KCTimeDict::addCTime(const QString &path, const QByteArray &resource, quint64 ctime)
 {
     Q_ASSERT(ctime != 0);
+    Q_ASSERT(!m_isStored);
     assert(!path.isEmpty());
-    m_hash.insert(key(path, resource), ctime);
+    m_hash[resource].insert(path, ctime);
 }
 
-quint32 KCTimeDict::ctime(const QString &path, const QByteArray &resource) const
+quint64 KCTimeDict::ctime(const QString &path, const QByteArray &resource) const
 {
-    return m_hash.value(key(path, resource), 0);
+    if (m_isStored) {
+        const int id = pathId(path, resource);
+        return id == -1 ? 0 : ctime(id);
+    }
+    auto it = m_hash.constFind(resource);
+    return it == m_hash.cend() ? 0 : it.value().value(path, 0);
 }
 
 void KCTimeDict::remove(const QString &path, const QByteArray &resource)
 {
-    m_hash.remove(key(path, resource));
+    if (m_isStored) {
+        const int id = pathId(path, resource);
+        if (id != -1) {
+            remove(id);
+        }
+        return;
+    }
+    auto it = m_hash.find(resource);
+    if (it != m_hash.end()) {
+        it.value().remove(path);
+    }
+}
+
+quint64 KCTimeDict::take(const QString &path, const QByteArray &resource)
+{
+    if (m_isStored) {
+        const int id = pathId(path, resource);
+        if (id == -1) {
+            return 0;
+        }
+        const quint64 timeStamp = ctime(id);
+        remove(id);
+        return timeStamp;
+    }
+    auto it = m_hash.find(resource);
+    return it == m_hash.end() ? 0 : it.value().take(path);
+}
+
+bool KCTimeDict::forEachFile(const std::function<bool(const QString &path, const QByteArray &resource, quint64 ctime)> &function) const
+{
+    if (m_isStored) {
+        for (int id = 0; id < m_count; ++id) {
+            if (!m_removed.testBit(id) && !function(storedPath(id), m_resources.value(qFromBigEndian<qint32>(record(id))), ctime(id))) {
+                return false;
+            }
+        }
+        return true;
+    }
+    for (auto it = m_hash.cbegin(); it != m_hash.cend(); ++it) {
+        for (auto pathIt = it.value().cbegin(); pathIt != it.value().cend(); ++pathIt) {
+            if (!function(pathIt.key(), it.key(), pathIt.value())) {
+                return false;
+            }
+        }
+    }
+    return true;
 }
 
 void KCTimeDict::dump() const
 {
-    qCDebug(SYCOCA) << m_hash.keys();
+    if (m_isStored) {
+        QStringList paths;
+        for (int id = 0; id < m_count; ++id) {
+            if (!m_removed.testBit(id)) {
+                paths.append(storedPath(id));
+            }
+        }
+        qCDebug(SYCOCA) << paths;
+        return;
+    }
+    for (auto it = m_hash.cbegin(); it != m_hash.cend(); ++it) {
+        qCDebug(SYCOCA) << it.key() << it.value().keys();
+    }
+}
+
+bool KCTimeDict::isEmpty() const
+{
+    if (m_isStored) {
+        return m_removed.count(true) == m_count;
+    }
+    return std::all_of(m_hash.cbegin(), m_hash.cend(), [](const QHash<QString, quint64> &paths) {
+        return paths.isEmpty();
+    });
+}
+
+// @return the path at @p pathOffset in @p paths, nullptr if it isn't in there
+static const char *storedPathData(const QByteArray &paths, qint32 pathOffset, qint32 pathLength)
+{
+    if (pathOffset < 0 || pathLength < 0 || 2 * (qint64(pathOffset) + pathLength) > paths.size()) {
+        return nullptr;
+    }
+    return paths.constData() + 2 * qint64(pathOffset);
+}
+
+const char *KCTimeDict::record(int pathId) const
+{
+    return m_records.constData() + pathId * s_recordSize;
 }
 
-void KCTimeDict::load(QDataStream &str)
+int KCTimeDict::pathId(const QString &path, const QByteArray &resource) const
 {
-    QString key;
-    quint32 ctime;
-    while (true) {
-        str >> key >> ctime;
-        if (key.isEmpty()) {
-            break;
+    const int resourceIndex = m_isStored ? m_resources.indexOf(resource) : -1;
+    if (resourceIndex == -1) {
+        return -1;
+    }
+    // Binary search in the records, sorted by resource index and path
+    int low = 0;
+    int high = m_count;
+    while (low < high) {
+        const int middle = low + (high - low) / 2;
+        const char *middleRecord = record(middle);
+        int cmp = qFromBigEndian<qint32>(middleRecord) - resourceIndex;
+        if (cmp == 0) {
+            const qint32 pathLength = qFromBigEndian<qint32>(middleRecord + 2 * sizeof(qint32));
+            const char *stored = storedPathData(m_paths, qFromBigEndian<qint32>(middleRecord + sizeof(qint32)), pathLength);
+            if (!stored) {
+                return -1;
+            }
+            cmp = compareStoredPath(stored, pathLength, path);
+        }
+        if (cmp < 0) {
+            low = middle + 1;
+        } else if (cmp > 0) {
+            high = middle;
+        } else {
+            return m_removed.testBit(middle) ? -1 : middle;
         }
-        m_hash.insert(key, ctime);
     }
+    return -1;
+}
+
+quint64 KCTimeDict::ctime(int pathId) const
+{
+    Q_ASSERT(m_isStored && pathId >= 0 && pathId < m_count);
+    return qFromBigEndian<quint64>(record(pathId) + 3 * sizeof(qint32));
+}
+
+void KCTimeDict::remove(int pathId)
+{
+    Q_ASSERT(m_isStored && pathId >= 0 && pathId < m_count);
+    m_removed.setBit(pathId);
+}
+
+QString KCTimeDict::storedPath(int pathId) const
+{
+    const qint32 pathLength = qFromBigEndian<qint32>(record(pathId) + 2 * sizeof(qint32));
+    const char *stored = storedPathData(m_paths, qFromBigEndian<qint32>(record(pathId) + sizeof(qint32)), pathLength);
+    if (!stored) {
+        return QString();
+    }
+    QString path(pathLength, Qt::Uninitialized);
+    qFromBigEndian<quint16>(stored, path.size(), path.data());
+    return path;
+}
+
+void KCTimeDict::load(QDataStream *str)
+{
+    qint32 resourceCount;
+    (*str) >> resourceCount;
+    for (qint32 i = 0; i < resourceCount && str->status() == QDataStream::Ok; ++i) {
+        QByteArray resource;
+        (*str) >> resource;
+        m_resources.append(resource);
+    }
+    qint32 count;
+    (*str) >> count;
+    const qint64 recordsSize = qint64(count) * s_recordSize;
+    if (str->status() != QDataStream::Ok || count < 0 || recordsSize > str->device()->bytesAvailable()) {
+        qCWarning(SYCOCA) << "Invalid timestamp dict";
+        return;
+    }
+    QByteArray records(recordsSize, Qt::Uninitialized);
+    str->readRawData(records.data(), recordsSize);
+    // The paths are written in the order of the records, the last one ends them
+    qint64 pathsSize = 0;
+    if (count > 0) {
+        const char *last = records.constData() + recordsSize - s_recordSize;
+        pathsSize = 2 * (qint64(qFromBigEndian<qint32>(last + sizeof(qint32))) + qFromBigEndian<qint32>(last + 2 * sizeof(qint32)));
+    }
+    if (pathsSize < 0 || pathsSize > str->device()->bytesAvailable()) {
+        qCWarning(SYCOCA) << "Invalid timestamp dict";
+        return;
+    }
+    QByteArray paths(pathsSize, Qt::Uninitialized);
+    str->readRawData(paths.data(), pathsSize);
+
+    m_isStored = true;
+    m_records = records;
+    m_paths = paths;
+    m_count = count;
+    m_removed.resize(count);
 }
 
 void KCTimeDict::save(QDataStream &str) const
 {
-    for (auto it = m_hash.cbegin(), endIt = m_hash.cend(); it != endIt; ++it) {
-        str << it.key() << it.value();
+    Q_ASSERT(!m_isStored);
+    // The resources, then the records sorted by resource index and path, then the paths
+    const QList<QByteArray> resources = m_hash.keys();
+    str << qint32(resources.count());
+    for (const QByteArray &resource : resources) {
+        str << resource;
+    }
+    qint32 count = 0;
+    for (const QHash<QString, quint64> &paths : m_hash) {
+        count += paths.count();
+    }
+    str << count;
+
+    QByteArray pathData;
+    qint32 resourceIndex = 0;
+    for (auto it = m_hash.cbegin(); it != m_hash.cend(); ++it, ++resourceIndex) {
+        QStringList paths = it.value().keys();
+        std::sort(paths.begin(), paths.end());
+        for (const QString &path : std::as_const(paths)) {
+            str << resourceIndex << qint32(pathData.size() / 2) << qint32(path.size()) << it.value().value(path);
+            const qsizetype pos = pathData.size();
+            pathData.resize(pos + 2 * path.size());
+            qToBigEndian<quint16>(path.utf16(), path.size(), pathData.data() + pos);
+        }
     }
-    str << QString() << quint32(0);
+    str.writeRawData(pathData.constData(), pathData.size());
 }
 
 ///////////
@@ -105,6 +310,6 @@ KCTimeDict KCTimeFactory::loadDict() const
     QDataStream *str = stream();
     assert(str);
     str->device()->seek(m_dictOffset);
-    dict.load(*str);
+    dict.load(str);
     return dict;
 }
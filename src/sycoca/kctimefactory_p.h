@@ -8,30 +8,79 @@
 #ifndef KCTIME_FACTORY_H
 #define KCTIME_FACTORY_H
 
+#include <QBitArray>
 #include <QHash>
+#include <QMap>
+#include <kservice_export.h>
 #include <ksycocafactory_p.h>
 
+#include <functional>
+
 /**
- * Simple dict for associating a timestamp with each file in ksycoca
+ * Simple dict for associating a timestamp with each file in ksycoca.
+ * The "timestamp" is the sum of the modification times of the files, or a fingerprint
+ * of their contents if the database is built with KSYCOCA_FINGERPRINTS=1.
+ * See KBuildSycoca::fileStamp.
+ *
+ * The dict of the database being built is in memory. The dict of an existing database,
+ * see KCTimeFactory::loadDict(), is searched as it is stored: a table sorted by resource
+ * and path, over the stored paths. Its files are identified by path ids, and removing
+ * one only marks it as removed. load() copies the table and the paths, so the dict
+ * doesn't depend on the database staying open, and searching it doesn't move the
+ * position of the database stream.
  */
-class KCTimeDict
+class KSERVICE_EXPORT KCTimeDict
 {
 public:
-    void addCTime(const QString &path, const QByteArray &resource, quint32 ctime);
-    quint32 ctime(const QString &path, const QByteArray &resource) const;
+    void addCTime(const QString &path, const QByteArray &resource, quint64 ctime);
+    quint64 ctime(const QString &path, const QByteArray &resource) const;
     void remove(const QString &path, const QByteArray &resource);
     void dump() const;
-    bool isEmpty() const
-    {
-        return m_hash.isEmpty();
-    }
+    bool isEmpty() const;
+
+    /**
+     * Removes @p path from the dict
+     * @return its timestamp, 0 if it wasn't there
+     */
+    quint64 take(const QString &path, const QByteArray &resource);
 
-    void load(QDataStream &str);
+    /**
+     * Calls @p function with the path, the resource and the timestamp of each file, until it returns false
+     * @return false if @p function did
+     */
+    bool forEachFile(const std::function<bool(const QString &path, const QByteArray &resource, quint64 ctime)> &function) const;
+
+    void load(QDataStream *str);
     void save(QDataStream &str) const;
 
 private:
-    typedef QHash<QString, quint32> Hash;
-    Hash m_hash;
+    /**
+     * @return the id of @p path in a stored dict, -1 if it's not there or was removed
+     */
+    int pathId(const QString &path, const QByteArray &resource) const;
+
+    /**
+     * @return the timestamp of the file @p pathId of a stored dict
+     */
+    quint64 ctime(int pathId) const;
+
+    /**
+     * Removes the file @p pathId from a stored dict
+     */
+    void remove(int pathId);
+
+    const char *record(int pathId) const;
+    QString storedPath(int pathId) const;
+
+    QMap<QByteArray, QHash<QString, quint64>> m_hash; // resource -> path -> timestamp, in memory
+
+    // Stored
+    bool m_isStored = false;
+    QList<QByteArray> m_resources;
+    QByteArray m_records; // big endian, as written by save()
+    QByteArray m_paths; // big endian UTF-16
+    int m_count = 0;
+    QBitArray m_removed;
 };
 
 /**
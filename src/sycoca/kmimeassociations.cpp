@@ -7,8 +7,6 @@
 
 #include "kmimeassociations_p.h"
 #include "sycocadebug.h"
-#include <KConfig>
-#include <KConfigGroup>
 #include <QDebug>
 #include <QFile>
 #include <QFileInfo>
@@ -41,6 +39,21 @@ text/plain=kate.desktop;
 */
 
 QStringList KMimeAssociations::mimeAppsFiles()
+{
+    const QStringList candidates = mimeAppsFileCandidates();
+    QStringList mimeappsFiles;
+    // collect existing files
+    for (const QString &candidate : candidates) {
+        const QFileInfo fileInfo(candidate);
+        const QString filePath = fileInfo.canonicalFilePath();
+        if (!filePath.isEmpty() && !mimeappsFiles.contains(filePath)) {
+            mimeappsFiles.append(filePath);
+        }
+    }
+    return mimeappsFiles;
+}
+
+QStringList KMimeAssociations::mimeAppsFileCandidates()
 {
     QStringList mimeappsFileNames;
     // make the list of possible filenames from the spec ($desktop-mimeapps.list, then mimeapps.list)
@@ -51,18 +64,13 @@ QStringList KMimeAssociations::mimeAppsFiles()
     }
     mimeappsFileNames.append(QStringLiteral("mimeapps.list"));
     const QStringList mimeappsDirs = mimeAppsDirs();
-    QStringList mimeappsFiles;
-    // collect existing files
+    QStringList candidates;
     for (const QString &dir : mimeappsDirs) {
         for (const QString &file : std::as_const(mimeappsFileNames)) {
-            const QFileInfo fileInfo(dir + QLatin1Char('/') + file);
-            const QString filePath = fileInfo.canonicalFilePath();
-            if (!filePath.isEmpty() && !mimeappsFiles.contains(filePath)) {
-                mimeappsFiles.append(filePath);
-            }
+            candidates.append(dir + QLatin1Char('/') + file);
         }
     }
-    return mimeappsFiles;
+    return candidates;
 }
 
 QStringList KMimeAssociations::mimeAppsDirs()
@@ -85,41 +93,198 @@ void KMimeAssociations::parseAllMimeAppsList()
     }
 }
 
+// @return the value of the hexadecimal digit @p c, -1 if it isn't one
+static int hexValue(char c)
+{
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    }
+    if (c >= 'A' && c <= 'F') {
+        return c - 'A' + 10;
+    }
+    return -1;
+}
+
+// The value of a key in a list entry, like KConfigGroup::readXdgListEntry reads it
+static QStringList readXdgList(const QByteArray &value)
+{
+    // Unescape like KConfig does, keeping "\;" for the list separators.
+    // Before decoding from UTF-8, as "\xHH" escapes a byte.
+    QByteArray unescapedData;
+    unescapedData.reserve(value.size());
+    for (qsizetype i = 0; i < value.size(); ++i) {
+        if (value.at(i) != '\\' || i + 1 == value.size()) {
+            unescapedData += value.at(i);
+            continue;
+        }
+        const char next = value.at(++i);
+        switch (next) {
+        case 's':
+            unescapedData += ' ';
+            break;
+        case 't':
+            unescapedData += '\t';
+            break;
+        case 'n':
+            unescapedData += '\n';
+            break;
+        case 'r':
+            unescapedData += '\r';
+            break;
+        case '\\':
+            unescapedData += '\\';
+            break;
+        case 'x': {
+            const int high = i + 2 < value.size() ? hexValue(value.at(i + 1)) : -1;
+            const int low = high == -1 ? -1 : hexValue(value.at(i + 2));
+            if (low != -1) {
+                unescapedData += char(high * 16 + low);
+                i += 2;
+                break;
+            }
+            Q_FALLTHROUGH(); // not an escaped byte, kept as is
+        }
+        default:
+            unescapedData += '\\';
+            unescapedData += next;
+            break;
+        }
+    }
+    const QString unescaped = QString::fromUtf8(unescapedData);
+
+    QStringList list;
+    QString item;
+    bool quoted = false;
+    for (const QChar c : std::as_const(unescaped)) {
+        if (quoted) {
+            item += c;
+            quoted = false;
+        } else if (c == QLatin1Char('\\')) {
+            quoted = true;
+        } else if (c == QLatin1Char(';')) {
+            list.append(item);
+            item.clear();
+        } else {
+            item += c;
+        }
+    }
+    if (!item.isEmpty()) {
+        list.append(item);
+    }
+    return list;
+}
+
 void KMimeAssociations::parseMimeAppsList(const QString &file, int basePreference)
 {
-    KConfig profile(file, KConfig::SimpleConfig);
+    // Read the groups we need in one pass over the file, rather than through KConfig
+    Group addedAssociations;
+    Group removedAssociations;
+    Group addedKDEServiceAssociations;
+    Group removedKDEServiceAssociations;
+    Group defaultApplications;
+
+    QFile mimeAppsFile(file);
+    if (mimeAppsFile.open(QIODevice::ReadOnly)) {
+        const QByteArray contents = mimeAppsFile.readAll();
+        Group *group = nullptr;
+        qsizetype lineStart = 0;
+        while (lineStart < contents.size()) {
+            qsizetype lineEnd = contents.indexOf('\n', lineStart);
+            if (lineEnd == -1) {
+                lineEnd = contents.size();
+            }
+            const QByteArrayView line = QByteArrayView(contents).sliced(lineStart, lineEnd - lineStart).trimmed();
+            lineStart = lineEnd + 1;
+
+            if (line.isEmpty() || line.startsWith('#')) {
+                continue;
+            }
+            if (line.startsWith('[')) {
+                const qsizetype end = line.indexOf(']');
+                const QByteArrayView groupName = end == -1 ? QByteArrayView() : line.sliced(1, end - 1);
+                if (groupName == "Added Associations") {
+                    group = &addedAssociations;
+                } else if (groupName == "Removed Associations") {
+                    group = &removedAssociations;
+                } else if (groupName == "Added KDE Service Associations") {
+                    group = &addedKDEServiceAssociations;
+                } else if (groupName == "Removed KDE Service Associations") {
+                    group = &removedKDEServiceAssociations;
+                } else if (groupName == "Default Applications") {
+                    group = &defaultApplications;
+                } else {
+                    group = nullptr;
+                }
+                continue;
+            }
+            const qsizetype equal = line.indexOf('=');
+            if (!group || equal == -1) {
+                continue;
+            }
+            const QByteArrayView key = line.first(equal).trimmed();
+            if (key.isEmpty() || key.contains('[')) { // localized keys or options, not used here
+                continue;
+            }
+            group->insert(key.toByteArray(), line.sliced(equal + 1).trimmed().toByteArray()); // the last one wins, as with KConfig
+        }
+    }
+
     if (file.endsWith(QLatin1String("/mimeapps.list"))) { // not for $desktop-mimeapps.list
-        parseAddedAssociations(KConfigGroup(&profile, QStringLiteral("Added Associations")), file, basePreference);
-        parseRemovedAssociations(KConfigGroup(&profile, QStringLiteral("Removed Associations")), file);
+        parseAddedAssociations(addedAssociations, file, "Added Associations", basePreference);
+        parseRemovedAssociations(removedAssociations, file, "Removed Associations");
 
         // KDE extension for parts and plugins, see settings/filetypes/mimetypedata.cpp
-        parseAddedAssociations(KConfigGroup(&profile, QStringLiteral("Added KDE Service Associations")), file, basePreference);
-        parseRemovedAssociations(KConfigGroup(&profile, QStringLiteral("Removed KDE Service Associations")), file);
+        parseAddedAssociations(addedKDEServiceAssociations, file, "Added KDE Service Associations", basePreference);
+        parseRemovedAssociations(removedKDEServiceAssociations, file, "Removed KDE Service Associations");
     }
 
     // Default Applications is preferred over Added Associations.
     // Other than that, they work the same...
     // add 25 to the basePreference to make sure those service offers will have higher preferences
     // 25 is arbitrary half of the allocated preference indices for the current parsed mimeapps.list file, defined line 86
-    parseAddedAssociations(KConfigGroup(&profile, QStringLiteral("Default Applications")), file, basePreference + 25);
+    parseAddedAssociations(defaultApplications, file, "Default Applications", basePreference + 25);
 }
 
-void KMimeAssociations::parseAddedAssociations(const KConfigGroup &group, const QString &file, int basePreference)
+void KMimeAssociations::setServicesByStorageId(const QHash<QString, KService::Ptr> *services)
+{
+    m_servicesByStorageId = services;
+}
+
+KService::Ptr KMimeAssociations::findService(const QString &storageId)
+{
+    if (m_servicesByStorageId) {
+        if (KService::Ptr service = m_servicesByStorageId->value(storageId)) {
+            return service;
+        }
+    }
+    // The same services are listed in many groups and files, look each one up once
+    auto it = m_foundServices.constFind(storageId);
+    if (it == m_foundServices.cend()) {
+        it = m_foundServices.insert(storageId, m_serviceFactory->findServiceByStorageId(storageId));
+    }
+    return it.value();
+}
+
+void KMimeAssociations::parseAddedAssociations(const Group &group, const QString &file, const char *groupName, int basePreference)
 {
     Q_UNUSED(file) // except in debug statements
+    Q_UNUSED(groupName)
     QMimeDatabase db;
-    const auto keyList = group.keyList();
-    for (const QString &mimeName : keyList) {
-        const QStringList services = group.readXdgListEntry(mimeName);
+    for (auto it = group.cbegin(), end = group.cend(); it != end; ++it) {
+        const QString mimeName = QString::fromUtf8(it.key());
+        const QStringList services = readXdgList(it.value());
         const QString resolvedMimeName = mimeName.startsWith(QLatin1String("x-scheme-handler/")) ? mimeName : db.mimeTypeForName(mimeName).name();
         if (resolvedMimeName.isEmpty()) {
-            qCDebug(SYCOCA) << file << "specifies unknown MIME type" << mimeName << "in" << group.name();
+            qCDebug(SYCOCA) << file << "specifies unknown MIME type" << mimeName << "in" << groupName;
         } else {
             int pref = basePreference;
             for (const QString &service : services) {
-                KService::Ptr pService = m_serviceFactory->findServiceByStorageId(service);
+                KService::Ptr pService = findService(service);
                 if (!pService) {
-                    qCDebug(SYCOCA) << file << "specifies unknown service" << service << "in" << group.name();
+                    qCDebug(SYCOCA) << file << "specifies unknown service" << service << "in" << groupName;
                 } else {
                     // qDebug() << "adding mime" << resolvedMimeName << "to service" << pService->entryPath() << "pref=" << pref;
                     m_offerHash.addServiceOffer(resolvedMimeName, KServiceOffer(pService, pref, 0));
@@ -130,21 +295,26 @@ void KMimeAssociations::parseAddedAssociations(const KConfigGroup &group, const
     }
 }
 
-void KMimeAssociations::parseRemovedAssociations(const KConfigGroup &group, const QString &file)
+void KMimeAssociations::parseRemovedAssociations(const Group &group, const QString &file, const char *groupName)
 {
     Q_UNUSED(file) // except in debug statements
-    const auto keyList = group.keyList();
-    for (const QString &mime : keyList) {
-        const QStringList services = group.readXdgListEntry(mime);
+    Q_UNUSED(groupName)
+    for (auto it = group.cbegin(), end = group.cend(); it != end; ++it) {
+        const QString mime = QString::fromUtf8(it.key());
+        const QStringList services = readXdgList(it.value());
+        QList<KService::Ptr> removedServices;
         for (const QString &service : services) {
-            KService::Ptr pService = m_serviceFactory->findServiceByStorageId(service);
+            KService::Ptr pService = findService(service);
             if (!pService) {
-                // qDebug() << file << "specifies unknown service" << service << "in" << group.name();
+                // qDebug() << file << "specifies unknown service" << service << "in" << groupName;
             } else {
                 // qDebug() << "removing mime" << mime << "from service" << pService.data() << pService->entryPath();
-                m_offerHash.removeServiceOffer(mime, pService);
+                removedServices.append(pService);
             }
         }
+        if (!removedServices.isEmpty()) {
+            m_offerHash.removeServiceOffers(mime, removedServices);
+        }
     }
 }
 
@@ -171,17 +341,23 @@ void KOfferHash::addServiceOffer(const QString &serviceType, const KServiceOffer
     }
 }
 
-void KOfferHash::removeServiceOffer(const QString &serviceType, const KService::Ptr &service)
+void KOfferHash::removeServiceOffers(const QString &serviceType, const QList<KService::Ptr> &services)
 {
     ServiceTypeOffersData &data = m_serviceTypeData[serviceType]; // find or create
-    data.removedOffers.insert(service);
-    data.offerSet.remove(service);
-
-    const QString id = service->storageId();
+    QSet<QString> ids;
+    for (const KService::Ptr &service : services) {
+        data.removedOffers.insert(service);
+        if (data.offerSet.remove(service)) {
+            ids.insert(service->storageId());
+        }
+    }
+    if (ids.isEmpty()) { // none of them is offered
+        return;
+    }
 
     auto &list = data.offers;
-    auto it = std::remove_if(list.begin(), list.end(), [&id](const KServiceOffer &offer) {
-        return offer.service()->storageId() == id;
+    auto it = std::remove_if(list.begin(), list.end(), [&ids](const KServiceOffer &offer) {
+        return ids.contains(offer.service()->storageId());
     });
     list.erase(it, list.end());
 }
@@ -194,3 +370,13 @@ bool KOfferHash::hasRemovedOffer(const QString &serviceType, const KService::Ptr
     }
     return false;
 }
+
+void KOfferHash::setOffers(const QString &serviceType, const QList<KServiceOffer> &offers)
+{
+    ServiceTypeOffersData &data = m_serviceTypeData[serviceType]; // find or create
+    data.offers = offers;
+    data.offerSet.clear();
+    for (const KServiceOffer &offer : offers) {
+        data.offerSet.insert(offer.service());
+    }
+}
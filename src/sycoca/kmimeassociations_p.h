@@ -9,9 +9,9 @@
 #define KMIMEASSOCIATIONS_H
 
 #include <QHash>
+#include <QMap>
 #include <QSet>
 #include <kserviceoffer.h>
-class KConfigGroup;
 class KServiceFactory;
 
 struct ServiceTypeOffersData {
@@ -37,8 +37,16 @@ public:
         return QList<KServiceOffer>();
     }
     void addServiceOffer(const QString &serviceType, const KServiceOffer &offer);
-    void removeServiceOffer(const QString &serviceType, const KService::Ptr &service);
+    /**
+     * Removes @p services from the offers for @p serviceType, in one pass over them
+     * if any of them is offered, without going through them otherwise
+     */
+    void removeServiceOffers(const QString &serviceType, const QList<KService::Ptr> &services);
     bool hasRemovedOffer(const QString &serviceType, const KService::Ptr &service) const;
+    /**
+     * Replaces the offers for @p serviceType, keeping the removed offers
+     */
+    void setOffers(const QString &serviceType, const QList<KServiceOffer> &offers);
 
     const QHash<QString, ServiceTypeOffersData> &serviceTypeData() const
     {
@@ -60,20 +68,35 @@ public:
     explicit KMimeAssociations(KOfferHash &offerHash, KServiceFactory *serviceFactory);
 
     static QStringList mimeAppsFiles();
+    /**
+     * @return the paths where mimeAppsFiles() are looked for, in the same order, existing or not
+     */
+    static QStringList mimeAppsFileCandidates();
 
     // Read mimeapps.list files
     void parseAllMimeAppsList();
 
     void parseMimeAppsList(const QString &file, int basePreference);
 
+    /**
+     * Resolves the services listed in the files with @p services, storage id -> service,
+     * before asking the service factory. For kbuildsycoca, whose factory has these in memory.
+     */
+    void setServicesByStorageId(const QHash<QString, KService::Ptr> *services);
+
 private:
     static QStringList mimeAppsDirs();
 
-    void parseAddedAssociations(const KConfigGroup &group, const QString &file, int basePreference);
-    void parseRemovedAssociations(const KConfigGroup &group, const QString &file);
+    using Group = QMap<QByteArray, QByteArray>; // key -> value, as written in the file
+
+    void parseAddedAssociations(const Group &group, const QString &file, const char *groupName, int basePreference);
+    void parseRemovedAssociations(const Group &group, const QString &file, const char *groupName);
+    KService::Ptr findService(const QString &storageId);
 
     KOfferHash &m_offerHash;
     KServiceFactory *m_serviceFactory;
+    const QHash<QString, KService::Ptr> *m_servicesByStorageId = nullptr;
+    QHash<QString, KService::Ptr> m_foundServices; // the lookups in m_serviceFactory, null if not found
 };
 
 #endif /* KMIMEASSOCIATIONS_H */
@@ -10,6 +10,7 @@
 
 #include "ksycoca.h"
 #include "ksycoca_p.h"
+#include "ksycocadirectoryscanner_p.h"
 #include "ksycocafactory_p.h"
 #include "ksycocatype.h"
 #include "ksycocautils_p.h"
@@ -48,7 +49,7 @@
  * However running apps should still be able to read it, so
  * only add to the data, never remove/modify.
  */
-#define KSYCOCA_VERSION 306
+#define KSYCOCA_VERSION 320
 
 #if HAVE_MADVISE || HAVE_MMAP
 #include <sys/mman.h> // This #include was checked when looking for posix_madvise
@@ -87,6 +88,7 @@ KSycocaPrivate::KSycocaPrivate(KSycoca *qq)
     , sycoca_mmap(nullptr)
     , m_mmapFile(nullptr)
     , m_device(nullptr)
+    , m_rootOffset(-1)
     , m_mimeTypeFactory(nullptr)
     , m_serviceFactory(nullptr)
     , m_serviceGroupFactory(nullptr)
@@ -235,19 +237,25 @@ bool KSycocaPrivate::openDatabase()
     bool result = true;
     if (!m_databasePath.isEmpty()) {
         static bool firstTime = true;
+        bool checkFingerprints = false;
         if (firstTime) {
             firstTime = false;
-            if (KSandbox::isFlatpak()) {
-                // We're running inside flatpak, which sets all times to 1970
-                // So the first very time, don't use an existing database, recreate it
-                qCDebug(SYCOCA) << "flatpak detected, ignoring" << m_databasePath;
-                return false;
-            }
+            // We're running inside flatpak, which sets all times to 1970
+            // So the first very time, don't use an existing database, recreate it,
+            // unless its fingerprints show that the files it comes from didn't change
+            checkFingerprints = KSandbox::isFlatpak();
         }
 
         qCDebug(SYCOCA) << "Opening ksycoca from" << m_databasePath;
         m_dbLastModified = QFileInfo(m_databasePath).lastModified();
         result = checkVersion();
+        if (result && checkFingerprints && !fingerprintsMatch()) {
+            qCDebug(SYCOCA) << "flatpak detected, ignoring" << m_databasePath;
+            const QString path = m_databasePath;
+            closeDatabase();
+            m_databasePath = path;
+            return false;
+        }
     } else { // No database file
         // qCDebug(SYCOCA) << "Could not open ksycoca";
         result = false;
@@ -307,6 +315,50 @@ QDataStream *&KSycocaPrivate::stream()
     return m_device->stream();
 }
 
+qint64 KSycocaPrivate::rootOffset()
+{
+    if (m_rootOffset == -1) {
+        m_rootOffset = findRootOffset(device()->device());
+    }
+    return m_rootOffset;
+}
+
+qint64 KSycocaPrivate::findRootOffset(QIODevice *device)
+{
+    const qint64 trailerOffset = device->size() - s_rootTrailerSize;
+    if (trailerOffset <= 0 || !device->seek(trailerOffset)) {
+        return 0;
+    }
+    QDataStream str(device);
+    str.setVersion(QDataStream::Qt_5_3);
+    qint32 rootOffset;
+    qint32 magic;
+    str >> rootOffset >> magic;
+    if (str.status() != QDataStream::Ok || magic != s_rootTrailerMagic || rootOffset < 0 || rootOffset >= trailerOffset) {
+        return 0;
+    }
+    // The root ends where the trailer begins, unless the trailer is garbage from an unfinished update
+    device->seek(rootOffset);
+    qint32 aVersion;
+    qint32 aId;
+    qint32 aOffset;
+    str >> aVersion;
+    while (str.status() == QDataStream::Ok) {
+        str >> aId;
+        if (aId == 0) {
+            break;
+        }
+        str >> aOffset;
+    }
+    qint32 headerOffset;
+    qint32 compactedSize;
+    str >> headerOffset >> compactedSize;
+    if (str.status() != QDataStream::Ok || device->pos() != trailerOffset) {
+        return 0;
+    }
+    return rootOffset;
+}
+
 void KSycocaPrivate::slotDatabaseChanged()
 {
     qCDebug(SYCOCA) << QThread::currentThread() << "got a notifyDatabaseChanged signal";
@@ -379,6 +431,7 @@ void KSycocaPrivate::closeDatabase()
 {
     delete m_device;
     m_device = nullptr;
+    m_rootOffset = -1;
 
     // It is very important to delete all factories here
     // since they cache information about the database file
@@ -430,12 +483,12 @@ KSycocaFactoryList *KSycoca::factories()
     return d->factories();
 }
 
-// Warning, checkVersion rewinds to the beginning of stream().
+// Warning, checkVersion rewinds stream() to the newest root.
 bool KSycocaPrivate::checkVersion()
 {
     QDataStream *m_str = device()->stream();
     Q_ASSERT(m_str);
-    m_str->device()->seek(0);
+    m_str->device()->seek(rootOffset());
     qint32 aVersion;
     *m_str >> aVersion;
     if (aVersion < KSYCOCA_VERSION) {
@@ -448,7 +501,7 @@ bool KSycocaPrivate::checkVersion()
     }
 }
 
-// If it returns true, we have a valid database and the stream has rewinded to the beginning
+// If it returns true, we have a valid database and the stream has rewinded to the newest root
 // and past the version number.
 bool KSycocaPrivate::checkDatabase(BehaviorsIfNotFound ifNotFound)
 {
@@ -484,7 +537,7 @@ bool KSycocaPrivate::checkDatabase(BehaviorsIfNotFound ifNotFound)
 
 QDataStream *KSycoca::findFactory(KSycocaFactoryId id)
 {
-    // Ensure we have a valid database (right version, and rewinded to beginning)
+    // Ensure we have a valid database (right version, and rewinded to the root)
     if (!d->checkDatabase(KSycocaPrivate::IfNotFoundRecreate)) {
         return nullptr;
     }
@@ -537,7 +590,11 @@ KSycocaHeader KSycocaPrivate::readSycocaHeader()
             break; // just read 0
         }
     }
-    // We now point to the header
+    // The header can be anywhere, incremental updates append a new one
+    qint32 headerOffset;
+    qint32 compactedSize;
+    *str >> headerOffset >> compactedSize;
+    str->device()->seek(headerOffset);
     QStringList directoryList;
     *str >> header >> directoryList;
     allResourceDirs.clear();
@@ -555,9 +612,11 @@ KSycocaHeader KSycocaPrivate::readSycocaHeader()
         *str >> mtime;
         extraFiles.insert(fileName, mtime);
     }
+    *str >> header.sourcesFingerprint;
 
     str->device()->seek(oldPos);
 
+    header.compactedSize = compactedSize;
     timeStamp = header.timeStamp;
 
     // for the useless public accessors. KF6: remove these two lines, the accessors and the vars.
@@ -567,6 +626,16 @@ KSycocaHeader KSycocaPrivate::readSycocaHeader()
     return header;
 }
 
+bool KSycocaPrivate::fingerprintsMatch()
+{
+    const KSycocaHeader header = readSycocaHeader();
+    if (!header.sourcesFingerprint) {
+        return false;
+    }
+    KSycocaDirectoryScanner scanner;
+    return scanner.sourcesFingerprint(allResourceDirs.keys(), extraFiles.keys()) == header.sourcesFingerprint;
+}
+
 class TimestampChecker
 {
 public:
@@ -662,6 +731,19 @@ bool KSycocaPrivate::needsRebuild()
     return extraFiles.keys() != files;
 }
 
+bool KSycocaPrivate::resourceDirsUpToDate()
+{
+    if (!timeStamp && databaseStatus != BadVersion) {
+        (void)readSycocaHeader();
+    }
+    if (!timeStamp || allResourceDirs.isEmpty()) {
+        return false;
+    }
+    auto files = KBuildSycoca::factoryExtraFiles();
+    files.sort();
+    return extraFiles.keys() == files && TimestampChecker().checkDirectoriesTimestamps(allResourceDirs);
+}
+
 bool KSycocaPrivate::buildSycoca()
 {
     KBuildSycoca builder;
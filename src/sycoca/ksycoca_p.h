@@ -21,6 +21,7 @@
 
 class QFile;
 class QDataStream;
+class QIODevice;
 class KSycocaAbstractDevice;
 class KMimeTypeFactory;
 class KServiceFactory;
@@ -32,12 +33,16 @@ struct KSycocaHeader {
     KSycocaHeader()
         : timeStamp(0)
         , updateSignature(0)
+        , compactedSize(0)
+        , sourcesFingerprint(0)
     {
     }
     QString prefixes;
     QString language;
     qint64 timeStamp; // in ms
     quint32 updateSignature;
+    qint32 compactedSize; // size of the file when it was last written in full, see KBuildSycoca::recreate
+    quint64 sourcesFingerprint; // 0 unless built with KBuildSycoca::useFingerprints()
 };
 
 QDataStream &operator>>(QDataStream &in, KSycocaHeader &h);
@@ -79,6 +84,12 @@ public:
      */
     bool needsRebuild();
 
+    /**
+     * @return true if none of the directories the database depends on changed since it was built,
+     * and the same extra files exist: only the contents of those may have changed
+     */
+    bool resourceDirsUpToDate();
+
     /**
      * Recreate the cache and reopen the database
      */
@@ -86,9 +97,32 @@ public:
 
     KSycocaHeader readSycocaHeader();
 
+    /**
+     * @return true if the database was built with fingerprints and the files it depends on
+     * still have the same contents, whatever their modification times
+     */
+    bool fingerprintsMatch();
+
     KSycocaAbstractDevice *device();
     QDataStream *&stream();
 
+    /**
+     * @return the offset of the newest root of the database, with the version and the table of factories.
+     * Incremental updates append a new one, see KBuildSycoca::save().
+     */
+    qint64 rootOffset();
+
+    /**
+     * Reads the trailer at the end of @p device, and checks the root it points to.
+     * @return the offset of that root, or 0 if the trailer isn't valid, e.g. while an update is being appended:
+     * the root at the beginning of the file is still valid then, with everything it points to
+     */
+    static qint64 findRootOffset(QIODevice *device);
+
+    // Every database ends with the offset of its newest root, followed by this
+    static constexpr qint32 s_rootTrailerMagic = 0x4b535943; // "KSYC"
+    static constexpr qint64 s_rootTrailerSize = 2 * sizeof(qint32);
+
     QString findDatabase();
     void slotDatabaseChanged();
 
@@ -139,6 +173,7 @@ private:
     const char *sycoca_mmap;
     QFile *m_mmapFile;
     KSycocaAbstractDevice *m_device;
+    qint64 m_rootOffset; // -1 until read from m_device
 
 public:
     KMimeTypeFactory *m_mimeTypeFactory;
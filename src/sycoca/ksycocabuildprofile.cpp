@@ -0,0 +1,160 @@
+/*
+    This file is part of the KDE libraries
+    SPDX-FileCopyrightText: 2026 agent <agent@local>
+
+    SPDX-License-Identifier: LGPL-2.0-or-later
+*/
+
+#include "ksycocabuildprofile_p.h"
+#include "ksycoca.h"
+
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+
+#include <algorithm>
+
+#ifdef Q_OS_UNIX
+#include <sys/resource.h>
+#include <time.h>
+#endif
+
+static KSycocaBuildProfile *s_currentProfile = nullptr;
+
+// CPU time used by all threads of the process, in ns; 0 where unknown
+static qint64 processCpuTime()
+{
+#if defined(Q_OS_UNIX) && defined(CLOCK_PROCESS_CPUTIME_ID)
+    struct timespec ts;
+    if (clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts) == 0) {
+        return qint64(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+    }
+#endif
+    return 0;
+}
+
+// Peak resident set size of the process, in KiB; 0 where unknown
+static qint64 peakRss()
+{
+#ifdef Q_OS_UNIX
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) == 0) {
+#ifdef Q_OS_DARWIN
+        return usage.ru_maxrss / 1024; // in bytes there
+#else
+        return usage.ru_maxrss;
+#endif
+    }
+#endif
+    return 0;
+}
+
+static double toMs(qint64 ns)
+{
+    return ns / 1000000.0;
+}
+
+KSycocaBuildProfile::KSycocaBuildProfile()
+    : m_cpuStart(processCpuTime())
+{
+    m_wallTimer.start();
+}
+
+KSycocaBuildProfile::~KSycocaBuildProfile()
+{
+    if (s_currentProfile == this) {
+        s_currentProfile = nullptr;
+    }
+}
+
+KSycocaBuildProfile *KSycocaBuildProfile::current()
+{
+    return s_currentProfile;
+}
+
+void KSycocaBuildProfile::setCurrent(KSycocaBuildProfile *profile)
+{
+    s_currentProfile = profile;
+}
+
+qsizetype KSycocaBuildProfile::phaseIndex(const char *name)
+{
+    const QString phaseName = QString::fromLatin1(name);
+    const QString parent = m_running.isEmpty() ? QString() : m_phases.at(m_running.last()).name;
+    for (qsizetype i = 0; i < m_phases.size(); ++i) {
+        if (m_phases.at(i).name == phaseName && m_phases.at(i).parent == parent) {
+            return i;
+        }
+    }
+    m_phases.append(PhaseData{phaseName, parent});
+    return m_phases.size() - 1;
+}
+
+KSycocaBuildProfile::Phase::Phase(const char *name)
+    : m_profile(s_currentProfile)
+{
+    if (m_profile) {
+        m_index = m_profile->phaseIndex(name);
+        m_profile->m_running.append(m_index);
+        m_wallStart = m_profile->m_wallTimer.nsecsElapsed();
+        m_cpuStart = processCpuTime();
+    }
+}
+
+KSycocaBuildProfile::Phase::~Phase()
+{
+    if (m_profile) {
+        PhaseData &data = m_profile->m_phases[m_index];
+        ++data.calls;
+        data.wallNs += m_profile->m_wallTimer.nsecsElapsed() - m_wallStart;
+        data.cpuNs += processCpuTime() - m_cpuStart;
+        m_profile->m_running.removeLast();
+    }
+}
+
+void KSycocaBuildProfile::count(const char *name, qint64 value)
+{
+    if (s_currentProfile) {
+        s_currentProfile->m_counts[QString::fromLatin1(name)] += value;
+    }
+}
+
+void KSycocaBuildProfile::countMax(const char *name, qint64 value)
+{
+    if (s_currentProfile) {
+        qint64 &counter = s_currentProfile->m_counts[QString::fromLatin1(name)];
+        counter = std::max(counter, value);
+    }
+}
+
+QByteArray KSycocaBuildProfile::toJson() const
+{
+    QJsonArray phases;
+    for (const PhaseData &data : m_phases) {
+        QJsonObject phase{
+            {QStringLiteral("name"), data.name},
+            {QStringLiteral("calls"), data.calls},
+            {QStringLiteral("wallMs"), toMs(data.wallNs)},
+            {QStringLiteral("cpuMs"), toMs(data.cpuNs)},
+        };
+        if (!data.parent.isEmpty()) {
+            phase.insert(QStringLiteral("parent"), data.parent);
+        }
+        phases.append(phase);
+    }
+
+    QJsonObject counts;
+    for (auto it = m_counts.cbegin(); it != m_counts.cend(); ++it) {
+        counts.insert(it.key(), it.value());
+    }
+
+    const QJsonObject report{
+        {QStringLiteral("databaseVersion"), KSycoca::version()},
+        {QStringLiteral("wallMs"), toMs(m_wallTimer.nsecsElapsed())},
+        {QStringLiteral("cpuMs"), toMs(processCpuTime() - m_cpuStart)},
+        {QStringLiteral("peakRssKiB"), peakRss()},
+        {QStringLiteral("phases"), phases},
+        {QStringLiteral("counts"), counts},
+    };
+    return QJsonDocument(report).toJson(QJsonDocument::Indented);
+}
@@ -0,0 +1,96 @@
+/*
+    This file is part of the KDE libraries
+    SPDX-FileCopyrightText: 2026 agent <agent@local>
+
+    SPDX-License-Identifier: LGPL-2.0-or-later
+*/
+
+#ifndef KSYCOCABUILDPROFILE_P_H
+#define KSYCOCABUILDPROFILE_P_H
+
+#include <kservice_export.h>
+
+#include <QByteArray>
+#include <QElapsedTimer>
+#include <QList>
+#include <QMap>
+#include <QString>
+
+/**
+ * @internal
+ *
+ * Collects where kbuildsycoca spends its time, for kbuildsycoca6 --profile.
+ *
+ * The build code marks its phases with Phase objects and reports what it processed with count().
+ * Both do nothing unless a profile was made current, so that they can stay in the code.
+ * They must only be used from the thread running the build.
+ */
+class KSERVICE_EXPORT KSycocaBuildProfile
+{
+public:
+    KSycocaBuildProfile();
+    ~KSycocaBuildProfile();
+
+    /**
+     * @return the profile of the running build, nullptr when not profiling
+     */
+    static KSycocaBuildProfile *current();
+
+    /**
+     * Makes @p profile collect the data of the following builds, or stops profiling with nullptr.
+     */
+    static void setCurrent(KSycocaBuildProfile *profile);
+
+    /**
+     * Measures the wall and CPU time of a phase of the build, from construction to destruction.
+     * A phase entered several times is reported once, with its total time and number of calls.
+     * Phases entered within another one are reported as its children.
+     */
+    class KSERVICE_EXPORT Phase
+    {
+    public:
+        explicit Phase(const char *name);
+        ~Phase();
+
+    private:
+        Q_DISABLE_COPY(Phase)
+        KSycocaBuildProfile *m_profile;
+        qsizetype m_index = -1;
+        qint64 m_wallStart = 0;
+        qint64 m_cpuStart = 0;
+    };
+
+    /**
+     * Adds @p value to the counter @p name.
+     */
+    static void count(const char *name, qint64 value = 1);
+
+    /**
+     * Raises the counter @p name to @p value, if it's lower.
+     */
+    static void countMax(const char *name, qint64 value);
+
+    /**
+     * @return the report as indented JSON: total times, phases, counters, peak RSS
+     */
+    QByteArray toJson() const;
+
+private:
+    struct PhaseData {
+        QString name;
+        QString parent;
+        qint64 calls = 0;
+        qint64 wallNs = 0;
+        qint64 cpuNs = 0;
+    };
+
+    qsizetype phaseIndex(const char *name);
+
+    QElapsedTimer m_wallTimer;
+    qint64 m_cpuStart;
+    QList<PhaseData> m_phases; // in the order they were first entered
+    QList<qsizetype> m_running; // indexes into m_phases
+    QMap<QString, qint64> m_counts;
+};
+
+#endif
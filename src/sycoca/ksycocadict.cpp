@@ -6,12 +6,14 @@
 */
 
 #include "ksycoca.h"
+#include "ksycocabuildprofile_p.h"
 #include "ksycocadict_p.h"
 #include "ksycocaentry.h"
 #include "sycocadebug.h"
 #include <kservice.h>
 
 #include <QBitArray>
+#include <QDataStream>
 #include <QIODevice>
 #include <QList>
 
@@ -318,6 +320,10 @@ void KSycocaDict::save(QDataStream &str)
         return;
     }
 
+    KSycocaBuildProfile::Phase phase("dict-save");
+    KSycocaBuildProfile::count("dictionaries");
+    KSycocaBuildProfile::count("dictEntries", count());
+
     d->offset = str.device()->pos();
 
     // qCDebug(SYCOCA) << "KSycocaDict:" << count() << "entries.";
@@ -442,6 +448,16 @@ void KSycocaDict::save(QDataStream &str)
             hashTable[hash].duplicates->append(entryPtr.get());
         }
     }
+    if (KSycocaBuildProfile::current()) {
+        KSycocaBuildProfile::count("dictHashTableSlots", sz);
+        for (unsigned int i = 0; i < sz; i++) {
+            if (hashTable[i].duplicates) {
+                KSycocaBuildProfile::count("dictCollisionChains");
+                KSycocaBuildProfile::count("dictCollidingEntries", hashTable[i].duplicates->count());
+                KSycocaBuildProfile::countMax("dictLongestCollisionChain", hashTable[i].duplicates->count());
+            }
+        }
+    }
 
     str << d->hashTableSize;
     str << d->hashList;
@@ -449,59 +465,64 @@ void KSycocaDict::save(QDataStream &str)
     d->offset = str.device()->pos(); // d->offset points to start of hashTable
     // qCDebug(SYCOCA) << QString("Start of Hash Table, offset = %1").arg(d->offset,8,16);
 
-    // Write the hashtable + the duplicates twice.
     // The duplicates are after the normal hashtable, but the offset of each
     // duplicate entry is written into the normal hashtable.
-    for (int pass = 1; pass <= 2; pass++) {
-        str.device()->seek(d->offset);
-        // qCDebug(SYCOCA) << QString("Writing hash table (pass #%1)").arg(pass);
-        for (uint i = 0; i < d->hashTableSize; i++) {
-            qint32 tmpid;
-            if (!hashTable[i].entry) {
-                tmpid = 0;
-            } else if (!hashTable[i].duplicates) {
-                tmpid = hashTable[i].entry->payload->offset(); // Positive ID
-            } else {
-                tmpid = -hashTable[i].duplicate_offset; // Negative ID
-            }
-            str << tmpid;
-            // qCDebug(SYCOCA) << QString("Hash table : %1").arg(tmpid,8,16);
-        }
-        // qCDebug(SYCOCA) << QString("End of Hash Table, offset = %1").arg(str.device()->at(),8,16);
-
-        // qCDebug(SYCOCA) << QString("Writing duplicate lists (pass #%1)").arg(pass);
-        for (uint i = 0; i < d->hashTableSize; i++) {
-            const QList<string_entry *> *dups = hashTable[i].duplicates;
-            if (dups) {
-                hashTable[i].duplicate_offset = str.device()->pos();
-
-                /*qCDebug(SYCOCA) << QString("Duplicate lists: Offset = %1 list_size = %2") .arg(hashTable[i].duplicate_offset,8,16).arg(dups->count());
-                 */
-                for (string_entry *dup : std::as_const(*dups)) {
-                    const qint32 offset = dup->payload->offset();
-                    if (!offset) {
-                        const QString storageId = dup->payload->storageId();
-                        qCDebug(SYCOCA) << "about to assert! dict=" << this << "storageId=" << storageId << dup->payload.data();
-                        if (dup->payload->isType(KST_KService)) {
-                            KService::Ptr service(static_cast<KService *>(dup->payload.data()));
-                            qCDebug(SYCOCA) << service->storageId() << service->entryPath();
-                        }
-                        // save() must have been called on the entry
-                        Q_ASSERT_X(offset,
-                                   "KSycocaDict::save",
-                                   QByteArray("entry offset is 0, save() was not called on " + dup->payload->storageId().toLatin1()
-                                              + " entryPath=" + dup->payload->entryPath().toLatin1())
-                                       .constData());
+    // So the duplicate lists are serialized first, relative to the end of the hashtable,
+    // then the hashtable and the lists are written once.
+    const qint64 endOfHashTable = d->offset + qint64(d->hashTableSize) * qint64(sizeof(qint32));
+    QByteArray duplicateLists;
+    QDataStream duplicateStr(&duplicateLists, QIODevice::WriteOnly);
+    duplicateStr.setVersion(str.version());
+    duplicateStr.setByteOrder(str.byteOrder());
+    for (uint i = 0; i < d->hashTableSize; i++) {
+        const QList<string_entry *> *dups = hashTable[i].duplicates;
+        if (dups) {
+            hashTable[i].duplicate_offset = endOfHashTable + duplicateStr.device()->pos();
+
+            /*qCDebug(SYCOCA) << QString("Duplicate lists: Offset = %1 list_size = %2") .arg(hashTable[i].duplicate_offset,8,16).arg(dups->count());
+             */
+            for (string_entry *dup : std::as_const(*dups)) {
+                const qint32 offset = dup->payload->offset();
+                if (!offset) {
+                    const QString storageId = dup->payload->storageId();
+                    qCDebug(SYCOCA) << "about to assert! dict=" << this << "storageId=" << storageId << dup->payload.data();
+                    if (dup->payload->isType(KST_KService)) {
+                        KService::Ptr service(static_cast<KService *>(dup->payload.data()));
+                        qCDebug(SYCOCA) << service->storageId() << service->entryPath();
                     }
-                    str << offset; // Positive ID
-                    str << dup->keyStr; // Key (QString)
+                    // save() must have been called on the entry
+                    Q_ASSERT_X(offset,
+                               "KSycocaDict::save",
+                               QByteArray("entry offset is 0, save() was not called on " + dup->payload->storageId().toLatin1()
+                                          + " entryPath=" + dup->payload->entryPath().toLatin1())
+                                   .constData());
                 }
-                str << qint32(0); // End of list marker (0)
+                duplicateStr << offset; // Positive ID
+                duplicateStr << dup->keyStr; // Key (QString)
             }
+            duplicateStr << qint32(0); // End of list marker (0)
         }
-        // qCDebug(SYCOCA) << QString("End of Dict, offset = %1").arg(str.device()->at(),8,16);
     }
 
+    // qCDebug(SYCOCA) << "Writing hash table";
+    for (uint i = 0; i < d->hashTableSize; i++) {
+        qint32 tmpid;
+        if (!hashTable[i].entry) {
+            tmpid = 0;
+        } else if (!hashTable[i].duplicates) {
+            tmpid = hashTable[i].entry->payload->offset(); // Positive ID
+        } else {
+            tmpid = -hashTable[i].duplicate_offset; // Negative ID
+        }
+        str << tmpid;
+        // qCDebug(SYCOCA) << QString("Hash table : %1").arg(tmpid,8,16);
+    }
+    // qCDebug(SYCOCA) << QString("End of Hash Table, offset = %1").arg(str.device()->at(),8,16);
+
+    Q_ASSERT(str.device()->pos() == endOfHashTable);
+    str.device()->write(duplicateLists);
+    // qCDebug(SYCOCA) << QString("End of Dict, offset = %1").arg(str.device()->at(),8,16);
+
     // qCDebug(SYCOCA) << "Cleaning up hash table.";
     for (uint i = 0; i < d->hashTableSize; i++) {
         delete hashTable[i].duplicates;
@@ -0,0 +1,300 @@
+/*
+    This file is part of the KDE libraries
+    SPDX-FileCopyrightText: 2026 agent <agent@local>
+
+    SPDX-License-Identifier: LGPL-2.0-or-later
+*/
+
+#include "ksycocadirectoryscanner_p.h"
+
+#include <QDir>
+#include <QDirIterator>
+#include <QFile>
+#include <QFileInfo>
+#include <QStandardPaths>
+#include <QtEndian>
+
+#include <algorithm>
+
+#if defined(Q_OS_UNIX) && !defined(Q_OS_DARWIN)
+#define KSYCOCA_SCAN_WITH_READDIR
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#ifdef KSYCOCA_SCAN_WITH_READDIR
+static qint64 lastModifiedMSecs(const struct stat &st)
+{
+    return qint64(st.st_mtim.tv_sec) * 1000 + st.st_mtim.tv_nsec / 1000000;
+}
+
+// Same answer as access(R_OK), which is only asked when the mode bits aren't enough
+static bool isReadable(int dirFd, const char *name, const struct stat &st)
+{
+    constexpr mode_t readableByAll = S_IRUSR | S_IRGRP | S_IROTH;
+    if ((st.st_mode & readableByAll) == readableByAll) {
+        return true;
+    }
+    if (st.st_uid == ::getuid() && ::getuid() != 0) {
+        return (st.st_mode & S_IRUSR) != 0;
+    }
+    return ::faccessat(dirFd, name, R_OK, 0) == 0;
+}
+#endif
+
+QList<KSycocaDirectoryScanner::Entry> KSycocaDirectoryScanner::entries(const QString &dir)
+{
+#ifdef KSYCOCA_SCAN_WITH_READDIR
+    const QByteArray encodedDir = QFile::encodeName(dir);
+    struct stat dirStat;
+    if (::stat(encodedDir.constData(), &dirStat) != 0 || !S_ISDIR(dirStat.st_mode)) {
+        return {};
+    }
+    const DirectoryId id(dirStat.st_dev, dirStat.st_ino);
+    auto it = m_listings.constFind(id);
+    if (it != m_listings.cend()) {
+        return it.value();
+    }
+
+    QList<Entry> list;
+    const int fd = ::open(encodedDir.constData(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    DIR *handle = fd == -1 ? nullptr : ::fdopendir(fd);
+    if (!handle) {
+        if (fd != -1) {
+            ::close(fd);
+        }
+        m_listings.insert(id, list);
+        return list;
+    }
+    while (const struct dirent *dirEntry = ::readdir(handle)) {
+        const char *name = dirEntry->d_name;
+        if (name[0] == '.') { // hidden, "." and ".."
+            continue;
+        }
+        Entry entry;
+        struct stat st;
+        if (dirEntry->d_type == DT_LNK) {
+            entry.isSymLink = true;
+        } else if (dirEntry->d_type == DT_UNKNOWN) {
+            entry.isSymLink = ::fstatat(fd, name, &st, AT_SYMLINK_NOFOLLOW) == 0 && S_ISLNK(st.st_mode);
+        }
+        if (::fstatat(fd, name, &st, 0) != 0) {
+            continue; // broken symlink, or deleted meanwhile
+        }
+        entry.name = QFile::decodeName(name);
+        entry.lastModified = lastModifiedMSecs(st);
+        entry.isDir = S_ISDIR(st.st_mode);
+        entry.isFile = S_ISREG(st.st_mode);
+        entry.isReadable = ::isReadable(fd, name, st);
+        list.append(entry);
+        m_fileInfos.insert(filePath(dir, entry.name), FileInfo{entry.lastModified, true, entry.isFile, entry.isReadable});
+    }
+    ::closedir(handle); // closes fd
+    m_listings.insert(id, list);
+    return list;
+#else
+    const QString key = QDir::cleanPath(dir);
+    auto it = m_listingsByPath.constFind(key);
+    if (it != m_listingsByPath.cend()) {
+        return it.value();
+    }
+    QList<Entry> list;
+    QDirIterator dirIt(dir, QDir::AllEntries | QDir::NoDotAndDotDot);
+    while (dirIt.hasNext()) {
+        dirIt.next();
+        const QFileInfo info = dirIt.fileInfo();
+        Entry entry;
+        entry.name = info.fileName();
+        entry.lastModified = info.lastModified().toMSecsSinceEpoch();
+        entry.isDir = info.isDir() && !info.isBundle();
+        entry.isFile = info.isFile();
+        entry.isSymLink = info.isSymLink();
+        entry.isReadable = info.isReadable();
+        list.append(entry);
+        m_fileInfos.insert(filePath(dir, entry.name), FileInfo{entry.lastModified, true, entry.isFile, entry.isReadable});
+    }
+    m_listingsByPath.insert(key, list);
+    return list;
+#endif
+}
+
+KSycocaDirectoryScanner::FileInfo KSycocaDirectoryScanner::fileInfo(const QString &path)
+{
+    const QString key = QDir::cleanPath(path);
+    auto it = m_fileInfos.constFind(key);
+    if (it != m_fileInfos.cend()) {
+        return it.value();
+    }
+    FileInfo info;
+#ifdef KSYCOCA_SCAN_WITH_READDIR
+    const QByteArray encodedPath = QFile::encodeName(key);
+    struct stat st;
+    if (::stat(encodedPath.constData(), &st) == 0) {
+        info.lastModified = lastModifiedMSecs(st);
+        info.exists = true;
+        info.isFile = S_ISREG(st.st_mode);
+        info.isReadable = ::isReadable(AT_FDCWD, encodedPath.constData(), st);
+    }
+#else
+    const QFileInfo qfi(key);
+    if (qfi.exists()) {
+        info.lastModified = qfi.lastModified().toMSecsSinceEpoch();
+        info.exists = true;
+        info.isFile = qfi.isFile();
+        info.isReadable = qfi.isReadable();
+    }
+#endif
+    m_fileInfos.insert(key, info);
+    return info;
+}
+
+qint64 KSycocaDirectoryScanner::lastModified(const QString &path)
+{
+    return fileInfo(path).lastModified;
+}
+
+QStringList KSycocaDirectoryScanner::locateAll(const QString &relativePath)
+{
+    if (!m_dataDirsKnown) {
+        m_dataDirs = QStandardPaths::standardLocations(QStandardPaths::GenericDataLocation);
+        m_dataDirsKnown = true;
+    }
+    QStringList result;
+    for (const QString &dataDir : std::as_const(m_dataDirs)) {
+        const QString path = dataDir + QLatin1Char('/') + relativePath;
+        if (fileInfo(path).isFile) {
+            result.append(path);
+        }
+    }
+    return result;
+}
+
+qint64 KSycocaDirectoryScanner::resourceDirectoryStamp(const QString &dir)
+{
+    qint64 stamp = lastModified(dir);
+    // Recurse only for services and menus, like visitResourceDirectory
+    if (dir.contains(QLatin1String("/applications"))) {
+        return stamp;
+    }
+    QStringList dirs{dir};
+    while (!dirs.isEmpty()) {
+        const QString current = dirs.takeLast();
+        const QList<Entry> list = entries(current);
+        for (const Entry &entry : list) {
+            if (entry.isDir && !entry.isSymLink) {
+                stamp = std::max(stamp, entry.lastModified);
+                dirs.append(filePath(current, entry.name));
+            }
+        }
+    }
+    return stamp;
+}
+
+QStringList KSycocaDirectoryScanner::relativeFilePaths(const QString &dir)
+{
+    QStringList files;
+    collectRelativeFilePaths(dir, QString(), files);
+    return files;
+}
+
+void KSycocaDirectoryScanner::collectRelativeFilePaths(const QString &dir, const QString &prefix, QStringList &files)
+{
+    const QList<Entry> list = entries(dir);
+    for (const Entry &entry : list) {
+        if (entry.isDir) {
+            if (!entry.isSymLink) {
+                collectRelativeFilePaths(filePath(dir, entry.name), prefix + entry.name + QLatin1Char('/'), files);
+            }
+        } else {
+            files.append(prefix + entry.name);
+        }
+    }
+}
+
+QString KSycocaDirectoryScanner::filePath(const QString &dir, const QString &name)
+{
+    return QDir::cleanPath(dir + QLatin1Char('/') + name);
+}
+
+// 64-bit FNV-1a: simple, fast enough for desktop files, and the same on every machine,
+// unlike qHash, so that a database shipped in an image can be checked elsewhere
+static const quint64 s_fingerprintBasis = Q_UINT64_C(14695981039346656037);
+
+static quint64 fingerprint(const char *data, qsizetype size, quint64 hash)
+{
+    for (qsizetype i = 0; i < size; ++i) {
+        hash ^= uchar(data[i]);
+        hash *= Q_UINT64_C(1099511628211);
+    }
+    return hash;
+}
+
+static quint64 fingerprint(const QString &string, quint64 hash)
+{
+    const QByteArray utf8 = string.toUtf8();
+    // The size separates "ab" + "c" from "a" + "bc"
+    return KSycocaDirectoryScanner::combineFingerprints(fingerprint(utf8.constData(), utf8.size(), hash), quint64(utf8.size()));
+}
+
+quint64 KSycocaDirectoryScanner::combineFingerprints(quint64 hash, quint64 value)
+{
+    const quint64 littleEndian = qToLittleEndian(value);
+    return fingerprint(reinterpret_cast<const char *>(&littleEndian), sizeof(littleEndian), hash);
+}
+
+quint64 KSycocaDirectoryScanner::contentFingerprint(const QString &path)
+{
+    auto it = m_contentFingerprints.constFind(path);
+    if (it != m_contentFingerprints.cend()) {
+        return it.value();
+    }
+    quint64 result = 0;
+    QFile file(path);
+    if (file.open(QIODevice::ReadOnly)) {
+        const QByteArray contents = file.readAll();
+        result = combineFingerprints(fingerprint(contents.constData(), contents.size(), s_fingerprintBasis), quint64(contents.size()));
+        if (result == 0) {
+            result = 1;
+        }
+    }
+    m_contentFingerprints.insert(path, result);
+    return result;
+}
+
+quint64 KSycocaDirectoryScanner::sourcesFingerprint(const QStringList &dirs, const QStringList &files)
+{
+    quint64 hash = s_fingerprintBasis;
+    for (const QString &dir : dirs) {
+        hash = fingerprint(dir, hash);
+        QStringList relFiles = relativeFilePaths(dir);
+        relFiles.sort(); // the order of the listing isn't stable
+        for (const QString &relFile : std::as_const(relFiles)) {
+            hash = fingerprint(relFile, hash);
+            hash = combineFingerprints(hash, contentFingerprint(filePath(dir, relFile)));
+        }
+    }
+    for (const QString &file : files) {
+        hash = fingerprint(file, hash);
+        hash = combineFingerprints(hash, contentFingerprint(file));
+    }
+    return hash;
+}
+
+qsizetype KSycocaDirectoryScanner::directoriesRead() const
+{
+    return m_listings.size() + m_listingsByPath.size();
+}
+
+qsizetype KSycocaDirectoryScanner::entriesListed() const
+{
+    qsizetype count = 0;
+    for (const QList<Entry> &list : m_listings) {
+        count += list.size();
+    }
+    for (const QList<Entry> &list : m_listingsByPath) {
+        count += list.size();
+    }
+    return count;
+}
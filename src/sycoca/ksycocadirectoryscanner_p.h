@@ -0,0 +1,133 @@
+/*
+    This file is part of the KDE libraries
+    SPDX-FileCopyrightText: 2026 agent <agent@local>
+
+    SPDX-License-Identifier: LGPL-2.0-or-later
+*/
+
+#ifndef KSYCOCADIRECTORYSCANNER_P_H
+#define KSYCOCADIRECTORYSCANNER_P_H
+
+#include <kservice_export.h>
+
+#include <QHash>
+#include <QList>
+#include <QString>
+#include <QStringList>
+
+#include <utility>
+
+/**
+ * @internal
+ *
+ * Lists directories for kbuildsycoca, reading each directory only once per build.
+ *
+ * The timestamps of the resource directories, the files of each resource, the applications
+ * of the menu code and the hashes of the files all come from here. Directories are identified
+ * by device and inode, so that a directory reached through different paths is read once too.
+ *
+ * On Linux and the BSDs this uses readdir() and one fstatat() per entry, without a QFileInfo
+ * per entry; elsewhere it falls back to QDirIterator.
+ */
+class KSERVICE_EXPORT KSycocaDirectoryScanner
+{
+public:
+    struct Entry {
+        QString name;
+        qint64 lastModified = 0; // in ms since epoch, following symlinks
+        bool isDir = false; // following symlinks
+        bool isFile = false; // following symlinks
+        bool isSymLink = false;
+        bool isReadable = false; // by the current user
+    };
+
+    struct FileInfo {
+        qint64 lastModified = 0; // in ms since epoch, following symlinks
+        bool exists = false;
+        bool isFile = false;
+        bool isReadable = false;
+    };
+
+    /**
+     * @return the entries of the directory @p dir, like QDirIterator(dir) lists them:
+     * hidden entries, "." and ".." and broken symlinks are skipped.
+     */
+    QList<Entry> entries(const QString &dir);
+
+    /**
+     * @return what QFileInfo(@p path) would say, following symlinks.
+     * Entries of the directories listed by entries() are known without any further stat.
+     */
+    FileInfo fileInfo(const QString &path);
+
+    /**
+     * @return the last modification time of @p path, in ms since epoch, following symlinks,
+     * or 0 if it doesn't exist
+     */
+    qint64 lastModified(const QString &path);
+
+    /**
+     * @return the same as QStandardPaths::locateAll(QStandardPaths::GenericDataLocation, @p relativePath),
+     * in the same order, using the cached file information
+     */
+    QStringList locateAll(const QString &relativePath);
+
+    /**
+     * @return the latest modification time of @p dir and, except for applications directories,
+     * of all its subdirectories which aren't symlinks. This is the stamp that KSycoca
+     * compares with, see KSycocaUtilsPrivate::visitResourceDirectory.
+     */
+    qint64 resourceDirectoryStamp(const QString &dir);
+
+    /**
+     * @return the paths, relative to @p dir, of all the files under @p dir,
+     * without following symlinks to directories, like QDirIterator::Subdirectories
+     */
+    QStringList relativeFilePaths(const QString &dir);
+
+    /**
+     * @return the path of the entry @p name in the directory @p dir, cleaned like QFileInfo::absoluteFilePath()
+     */
+    static QString filePath(const QString &dir, const QString &name);
+
+    /**
+     * @return a 64-bit fingerprint of the contents and the size of the file @p path,
+     * never 0 for a readable file, 0 otherwise. Each file is read once.
+     */
+    quint64 contentFingerprint(const QString &path);
+
+    /**
+     * @return a fingerprint of @p dirs, including the relative paths and the contents
+     * of all files under them (see relativeFilePaths()), and of the contents of @p files.
+     * Unlike modification times, it only changes when the files do.
+     */
+    quint64 sourcesFingerprint(const QStringList &dirs, const QStringList &files);
+
+    /**
+     * @return the fingerprint @p hash, updated with @p value
+     */
+    static quint64 combineFingerprints(quint64 hash, quint64 value);
+
+    /**
+     * @return how many directories were read so far, for kbuildsycoca6 --profile
+     */
+    qsizetype directoriesRead() const;
+
+    /**
+     * @return how many entries those directories had
+     */
+    qsizetype entriesListed() const;
+
+private:
+    void collectRelativeFilePaths(const QString &dir, const QString &prefix, QStringList &files);
+
+    using DirectoryId = std::pair<quint64, quint64>; // device, inode
+    QHash<DirectoryId, QList<Entry>> m_listings;
+    QHash<QString, QList<Entry>> m_listingsByPath; // when there are no inodes
+    QHash<QString, FileInfo> m_fileInfos;
+    QHash<QString, quint64> m_contentFingerprints;
+    QStringList m_dataDirs;
+    bool m_dataDirsKnown = false;
+};
+
+#endif
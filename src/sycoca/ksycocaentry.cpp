@@ -13,6 +13,7 @@
 KSycocaEntryPrivate::KSycocaEntryPrivate(QDataStream &_str, int iOffset)
     : offset(iOffset)
     , deleted(false)
+    , modified(false)
 {
     _str >> path;
 }
@@ -22,6 +22,7 @@ public:
     explicit KSycocaEntryPrivate(const QString &path_)
         : offset(0)
         , deleted(false)
+        , modified(false)
         , path(path_)
     {
     }
@@ -60,6 +61,7 @@ public:
 
     int offset;
     bool deleted;
+    bool modified; // by kbuildsycoca, since it was read from the database or last saved
     QString path;
 };
 
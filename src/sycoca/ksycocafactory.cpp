@@ -98,10 +98,13 @@ void KSycocaFactory::save(QDataStream &str)
 
     d->m_beginEntryOffset = str.device()->pos();
 
-    // Write all entries.
+    // Write all entries, except those kept from the database we append to
     int entryCount = 0;
     for (KSycocaEntry::Ptr entry : std::as_const(*m_entryDict)) {
-        entry->d_ptr->save(str);
+        if (!isStoredUnchanged(entry)) {
+            entry->d_ptr->save(str);
+            entry->d_ptr->modified = false; // stored as it is now, for a builder which keeps its entries
+        }
         entryCount++;
     }
 
@@ -223,9 +226,22 @@ const KSycocaDict *KSycocaFactory::sycocaDict() const
     return d->m_sycocaDict;
 }
 
+bool KSycocaFactory::isStoredUnchanged(const KSycocaEntry::Ptr &) const
+{
+    return false;
+}
+
 bool KSycocaFactory::isEmpty() const
 {
-    return d->m_beginEntryOffset == d->m_endEntryOffset;
+    // Entries kept from a previous database aren't between the begin and end offsets, count them
+    QDataStream *str = stream();
+    if (!str || d->m_endEntryOffset == 0) {
+        return true;
+    }
+    str->device()->seek(d->m_endEntryOffset);
+    qint32 entryCount;
+    (*str) >> entryCount;
+    return entryCount == 0;
 }
 
 QDataStream *KSycocaFactory::stream() const
@@ -108,6 +108,13 @@ public:
      */
     virtual void saveHeader(QDataStream &str);
 
+    /**
+     * @return true if @p entry is stored, unchanged, in the database which the new one
+     * is appended to. save() doesn't write such entries again, they keep their offset.
+     * @internal to kbuildsycoca
+     */
+    virtual bool isStoredUnchanged(const KSycocaEntry::Ptr &entry) const;
+
     /**
      * @return the resources for which this factory is responsible.
      * @internal to kbuildsycoca
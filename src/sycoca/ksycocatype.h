@@ -26,6 +26,7 @@ enum KSycocaType {
     // 8 was KST_KImageIOFormat in kdelibs4
     // 9 was KST_KProtocolInfo in kdelibs4
     KST_KServiceSeparator = 10,
+    KST_KMimeTypeNames = 11 /*internal*/,
     KST_KCustom = 1000,
 };
 
@@ -7,6 +7,7 @@
 
 #include "kbuildsycocainterface_p.h"
 #include "kservicefactory_p.h"
+#include "ksycocadirectoryscanner_p.h"
 #include "sycocadebug.h"
 #include "vfolder_menu_p.h"
 
@@ -14,7 +15,6 @@
 
 #include <QDebug>
 #include <QDir>
-#include <QDirIterator>
 #include <QFile>
 #include <QMap>
 #include <QStandardPaths>
@@ -434,26 +434,13 @@ static void tagBasePath(QDomDocument &doc, const QString &tag, const QString &pa
 
 QDomDocument VFolderMenu::loadDoc()
 {
-    QDomDocument doc;
     if (m_docInfo.path.isEmpty()) {
-        return doc;
-    }
-    QFile file(m_docInfo.path);
-    if (!file.open(QIODevice::ReadOnly)) {
-        qCWarning(SYCOCA) << "Could not open " << m_docInfo.path;
-        return doc;
-    }
-    if (file.size() == 0) {
-        return doc;
+        return QDomDocument();
     }
-    const auto result = doc.setContent(&file);
-    if (!result) {
-        qCWarning(SYCOCA) << "Parse error in " << m_docInfo.path << ", line " << result.errorLine << ", col " << result.errorColumn << ": "
-                          << result.errorMessage;
-        file.close();
+    QDomDocument doc = m_kbuildsycocaInterface->menuDocument(m_docInfo.path);
+    if (doc.isNull()) {
         return doc;
     }
-    file.close();
 
     tagBaseDir(doc, QStringLiteral("MergeFile"), m_docInfo.baseDir);
     tagBasePath(doc, QStringLiteral("MergeFile"), m_docInfo.path);
@@ -904,26 +891,22 @@ void VFolderMenu::loadApplications(const QString &dir, const QString &prefix)
 {
     qCDebug(SYCOCA) << "Looking up applications under" << dir;
 
-    QDirIterator it(dir);
-    while (it.hasNext()) {
-        it.next();
-        const QFileInfo fi = it.fileInfo();
-        const QString fn = fi.fileName();
-        if (fi.isDir() && !fi.isSymLink() && !fi.isBundle()) { // same check as in ksycocautils_p.h
-            if (fn == QLatin1String(".") || fn == QLatin1String("..")) {
-                continue;
-            }
-            loadApplications(fi.filePath(), prefix + fn + QLatin1Char('-'));
+    const QList<KSycocaDirectoryScanner::Entry> entries = m_kbuildsycocaInterface->directoryScanner()->entries(dir);
+    for (const KSycocaDirectoryScanner::Entry &entry : entries) {
+        const QString &fn = entry.name;
+        const QString filePath = KSycocaDirectoryScanner::filePath(dir, fn);
+        if (entry.isDir && !entry.isSymLink) { // same check as in ksycocautils_p.h
+            loadApplications(filePath, prefix + fn + QLatin1Char('-'));
             continue;
         }
-        if (fi.isFile()) {
+        if (entry.isFile) {
             if (!fn.endsWith(QLatin1String(".desktop"))) {
                 continue;
             }
-            KService::Ptr service = m_kbuildsycocaInterface->createService(fi.absoluteFilePath());
+            KService::Ptr service = m_kbuildsycocaInterface->createService(filePath);
 #ifndef NDEBUG
             if (fn.contains(QLatin1String("fake"))) {
-                qCDebug(SYCOCA) << "createService" << fi.absoluteFilePath() << "returned" << (service ? "valid service" : "NULL SERVICE");
+                qCDebug(SYCOCA) << "createService" << filePath << "returned" << (service ? "valid service" : "NULL SERVICE");
             }
 #endif
             if (service) {
@@ -938,32 +921,28 @@ void VFolderMenu::processLegacyDir(const QString &dir, const QString &relDir, co
     // qCDebug(SYCOCA).nospace() << "processLegacyDir(" << dir << ", " << relDir << ", " << prefix << ")";
 
     QHash<QString, KService::Ptr> items;
-    QDirIterator it(dir);
-    while (it.hasNext()) {
-        it.next();
-        const QFileInfo fi = it.fileInfo();
-        const QString fn = fi.fileName();
-        if (fi.isDir()) {
-            if (fn == QLatin1String(".") || fn == QLatin1String("..")) {
-                continue;
-            }
+    const QList<KSycocaDirectoryScanner::Entry> entries = m_kbuildsycocaInterface->directoryScanner()->entries(dir);
+    for (const KSycocaDirectoryScanner::Entry &entry : entries) {
+        const QString &fn = entry.name;
+        const QString filePath = KSycocaDirectoryScanner::filePath(dir, fn);
+        if (entry.isDir) {
             SubMenu *parentMenu = m_currentMenu;
 
             m_currentMenu = new SubMenu;
             m_currentMenu->name = fn;
-            m_currentMenu->directoryFile = fi.absoluteFilePath() + QLatin1String("/.directory");
+            m_currentMenu->directoryFile = filePath + QLatin1String("/.directory");
 
             parentMenu->subMenus.append(m_currentMenu);
 
-            processLegacyDir(fi.filePath(), relDir + fn + QLatin1Char('/'), prefix);
+            processLegacyDir(filePath, relDir + fn + QLatin1Char('/'), prefix);
             m_currentMenu = parentMenu;
             continue;
         }
-        if (fi.isFile() /*&& !fi.isSymLink() ?? */) {
+        if (entry.isFile /*&& !entry.isSymLink ?? */) {
             if (!fn.endsWith(QLatin1String(".desktop"))) {
                 continue;
             }
-            KService::Ptr service = m_kbuildsycocaInterface->createService(fi.absoluteFilePath());
+            KService::Ptr service = m_kbuildsycocaInterface->createService(filePath);
             if (service) {
                 const QString id = prefix + fn;
 
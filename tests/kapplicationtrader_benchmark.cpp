@@ -0,0 +1,57 @@
+/*
+    This file is part of the KDE libraries
+    SPDX-FileCopyrightText: 2026 agent <agent@local>
+
+    SPDX-License-Identifier: LGPL-2.0-or-later
+*/
+
+#include <KApplicationTrader>
+
+#include <QStandardPaths>
+#include <QTest>
+
+// Runs on the installed applications, unlike the unit test: compare the times of both rows
+class KApplicationTraderBenchmark : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void benchmarkParallelFilter_data();
+    void benchmarkParallelFilter();
+};
+
+// An expensive filter: it looks for the executable of each service in $PATH
+static bool hasExecutable(const KService::Ptr &service)
+{
+    const QString executable = service->exec().section(QLatin1Char(' '), 0, 0, QString::SectionSkipEmpty);
+    return !executable.isEmpty() && !QStandardPaths::findExecutable(executable).isEmpty();
+}
+
+void KApplicationTraderBenchmark::benchmarkParallelFilter_data()
+{
+    QTest::addColumn<bool>("parallel");
+
+    QTest::newRow("serial") << false;
+    QTest::newRow("parallel") << true;
+}
+
+void KApplicationTraderBenchmark::benchmarkParallelFilter()
+{
+    QFETCH(bool, parallel);
+    const KApplicationTrader::QueryOptions options = parallel ? KApplicationTrader::ParallelFilter : KApplicationTrader::NoQueryOptions;
+
+    // Also checks that both give the same services
+    const KService::List services = KApplicationTrader::query(hasExecutable, options);
+    QCOMPARE(services.count(), KApplicationTrader::query(hasExecutable).count());
+    qDebug() << services.count() << "of" << KApplicationTrader::query([](const KService::Ptr &) {
+        return true;
+    }).count() << "applications have their executable";
+
+    QBENCHMARK {
+        KApplicationTrader::query(hasExecutable, options);
+    }
+}
+
+QTEST_GUILESS_MAIN(KApplicationTraderBenchmark)
+
+#include "kapplicationtrader_benchmark.moc"